@@ -0,0 +1,104 @@
+// Compares building and encoding a tree of records with argdata_builder and
+// with argdata_t::create_*(), which allocates every node separately.
+
+#include <memory>
+#include <vector>
+
+#include <cloudabi/argdata_builder.hpp>
+
+#include "bench.hpp"
+
+namespace {
+
+// Every record is a map of an id, a name, a score and two tags, which is
+// eleven nodes.
+constexpr int n_records = 1000;
+constexpr int nodes_per_record = 11;
+
+// Keeps the nodes and the arrays of children alive for as long as the tree
+// is used, as argdata_t::create_map() and create_seq() require.
+struct argdata_t_tree {
+	std::vector<std::unique_ptr<argdata_t>> nodes;
+	std::vector<std::vector<argdata_t const *>> arrays;
+
+	argdata_t const *add(std::unique_ptr<argdata_t> node) {
+		nodes.push_back(std::move(node));
+		return nodes.back().get();
+	}
+
+	range<argdata_t const *const> array(std::vector<argdata_t const *> a) {
+		arrays.push_back(std::move(a));
+		return {arrays.back().data(), arrays.back().size()};
+	}
+};
+
+void build_argdata_t(std::vector<unsigned char> &out) {
+	argdata_t_tree t;
+	std::vector<argdata_t const *> records;
+	for (int i = 0; i < n_records; ++i) {
+		auto keys = t.array({
+			t.add(argdata_t::create_str("id")),
+			t.add(argdata_t::create_str("name")),
+			t.add(argdata_t::create_str("score")),
+			t.add(argdata_t::create_str("tags")),
+		});
+		auto tags = t.array({
+			t.add(argdata_t::create_str("benchmark")),
+			t.add(argdata_t::create_str("record")),
+		});
+		auto values = t.array({
+			t.add(argdata_t::create_int(i)),
+			t.add(argdata_t::create_str("a record of the benchmark")),
+			t.add(argdata_t::create_float(i * 0.5)),
+			t.add(argdata_t::create_seq(tags)),
+		});
+		records.push_back(t.add(argdata_t::create_map(keys, values)));
+	}
+	argdata_t::create_seq(t.array(std::move(records)))->encode(out);
+}
+
+void build_builder(argdata_builder &b, std::vector<unsigned char> &out) {
+	using node = argdata_builder::node;
+	b.clear();
+	std::vector<node const *> records;
+	records.reserve(n_records);
+	for (int i = 0; i < n_records; ++i) {
+		records.push_back(b.create_map({
+			{b.create_str("id"), b.create_int(i)},
+			{b.create_str("name"), b.create_str("a record of the benchmark")},
+			{b.create_str("score"), b.create_float(i * 0.5)},
+			{b.create_str("tags"), b.create_seq({
+				b.create_str("benchmark"),
+				b.create_str("record"),
+			})},
+		}));
+	}
+	b.create_seq(range<node const *const>(records.data(), records.size()))->encode(out);
+}
+
+}
+
+void program_main(argdata_t const *ad) {
+	bench::environment env = bench::parse(ad);
+
+	std::vector<unsigned char> expected, out;
+	argdata_builder b(1 << 20);
+	build_argdata_t(expected);
+	build_builder(b, out);
+	bench::check(env, out == expected, "argdata_builder encodes differently");
+
+	double t_argdata_t = bench::measure([&] {
+		build_argdata_t(out);
+		bench::keep(out);
+	});
+	double t_builder = bench::measure([&] {
+		build_builder(b, out);
+		bench::keep(out);
+	});
+
+	double n_nodes = n_records * nodes_per_record + 1;
+	bench::report(env, "argdata_t: build and encode", t_argdata_t / n_nodes, "ns/node");
+	bench::report(env, "argdata_builder: build and encode", t_builder / n_nodes, "ns/node");
+	bench::report(env, "argdata_builder: speedup", t_argdata_t / t_builder, "x");
+	exit(0);
+}
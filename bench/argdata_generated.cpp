@@ -0,0 +1,124 @@
+// Measures decoding records with a decoder generated by generate_argdata.py
+// from route.schema, against the usual loop over argdata_t::as_map() that
+// compares every key as a string.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cloudabi/argdata.hpp>
+#include <cloudabi/argdata_view.hpp>
+
+#include "bench.hpp"
+#include "route.hpp"
+
+namespace {
+
+constexpr int n_records = 1000;
+
+bool operator==(route const &a, route const &b) {
+	return a.destination == b.destination && a.gateway == b.gateway &&
+		a.metric == b.metric && a.tags == b.tags &&
+		a.options.reject == b.options.reject && a.options.mtu == b.options.mtu;
+}
+
+bool decode_options(argdata_t const *value, route_options &result) {
+	for (auto const &i : value->as_map()) {
+		string_view key = i.first->as_str();
+		if (key == "reject") {
+			auto x = i.second->get_bool();
+			if (!x) return false;
+			result.reject = *x;
+		} else if (key == "mtu") {
+			auto x = i.second->get_uint();
+			if (!x) return false;
+			result.mtu = *x;
+		}
+	}
+	return true;
+}
+
+bool decode_route(argdata_t const *value, route &result) {
+	for (auto const &i : value->as_map()) {
+		string_view key = i.first->as_str();
+		if (key == "destination") {
+			auto x = i.second->get_str();
+			if (!x) return false;
+			result.destination = *x;
+		} else if (key == "gateway") {
+			auto x = i.second->get_str();
+			if (!x) return false;
+			result.gateway = *x;
+		} else if (key == "metric") {
+			auto x = i.second->get_uint();
+			if (!x) return false;
+			result.metric = *x;
+		} else if (key == "tags") {
+			result.tags.clear();
+			for (argdata_t const *e : i.second->as_seq()) {
+				auto x = e->get_str();
+				if (!x) return false;
+				result.tags.push_back(*x);
+			}
+		} else if (key == "options") {
+			if (!decode_options(i.second, result.options)) return false;
+		}
+	}
+	return true;
+}
+
+}
+
+void program_main(argdata_t const *ad) {
+	bench::environment env = bench::parse(ad);
+
+	// The strings must outlive the records that point at them.
+	std::vector<std::string> names;
+	for (int i = 0; i < n_records; ++i) {
+		names.push_back("10." + std::to_string(i / 256) + "." + std::to_string(i % 256) + ".0/24");
+	}
+	std::vector<std::vector<unsigned char>> encoded(n_records);
+	std::vector<int> fds;
+	for (int i = 0; i < n_records; ++i) {
+		route r;
+		r.destination = names[i];
+		r.gateway = "192.168.1.1";
+		r.metric = std::uint64_t(i);
+		r.tags = {"static", i % 2 ? "odd" : "even"};
+		r.options.reject = i % 7 == 0;
+		r.options.mtu = 1500;
+		r.encode(encoded[i], fds);
+	}
+
+	std::vector<std::unique_ptr<argdata_t>> values;
+	std::vector<argdata_view> views;
+	for (auto &e : encoded) {
+		values.push_back(argdata_t::create_encoded(range<unsigned char>(e.data(), e.size())));
+		views.emplace_back(range<unsigned char const>(e.data(), e.size()));
+	}
+
+	for (int i = 0; i < n_records; ++i) {
+		route a;
+		auto b = route::decode(views[i]);
+		bench::check(env, decode_route(values[i].get(), a), "argdata_t can't decode a record");
+		bench::check(env, bool(b), "the generated decoder can't decode a record");
+		bench::check(env, a == *b, "the generated decoder gives a different record");
+	}
+
+	double t_argdata_t = bench::measure([&] {
+		for (auto const &v : values) {
+			route r;
+			bench::keep(decode_route(v.get(), r));
+			bench::keep(r);
+		}
+	});
+	double t_generated = bench::measure([&] {
+		for (argdata_view v : views) bench::keep(route::decode(v));
+	});
+
+	bench::report(env, "argdata_t: as_map() with string keys", t_argdata_t / n_records, "ns/record");
+	bench::report(env, "generated decode()", t_generated / n_records, "ns/record");
+	bench::report(env, "generated decode(): speedup", t_argdata_t / t_generated, "x");
+	exit(0);
+}
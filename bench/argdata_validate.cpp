@@ -0,0 +1,111 @@
+// Measures argdata_validate() on multi-megabyte inputs of strings, against
+// a scalar UTF-8 check and against copying the same amount of memory.
+//
+// This is built once with the default flags, and once with -mavx2 where the
+// compiler supports it, as the vector instructions are picked at compile
+// time.
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <cloudabi/argdata_builder.hpp>
+#include <cloudabi/argdata_validate.hpp>
+
+#include "bench.hpp"
+
+#if defined(__AVX2__)
+#define SIMD "AVX2"
+#elif defined(__SSE2__)
+#define SIMD "SSE2"
+#else
+#define SIMD "scalar"
+#endif
+
+namespace {
+
+constexpr int n_strings = 4096;
+
+// The same checks as argdata_validate_utf8(), one byte at a time.
+bool scalar_utf8(unsigned char const *p, unsigned char const *e) {
+	while (p != e) {
+		unsigned char c = *p++;
+		if (c >= 0x01 && c <= 0x7f) continue;
+		std::size_t n;
+		unsigned char min = 0x80, max = 0xbf;
+		if (c >= 0xc2 && c <= 0xdf) {
+			n = 1;
+		} else if (c >= 0xe0 && c <= 0xef) {
+			n = 2;
+			if (c == 0xe0) min = 0xa0;
+			if (c == 0xed) max = 0x9f;
+		} else if (c >= 0xf0 && c <= 0xf4) {
+			n = 3;
+			if (c == 0xf0) min = 0x90;
+			if (c == 0xf4) max = 0x8f;
+		} else {
+			return false;
+		}
+		if (std::size_t(e - p) < n || *p < min || *p > max) return false;
+		for (std::size_t i = 1; i < n; ++i) {
+			if ((p[i] & 0xc0) != 0x80) return false;
+		}
+		p += n;
+	}
+	return true;
+}
+
+// A sequence of strings of about a kilobyte each, made of copies of line.
+std::vector<unsigned char> make_input(std::string const &line) {
+	std::string s;
+	while (s.size() < 1000) s += line;
+	argdata_builder b(1 << 20);
+	std::vector<argdata_builder::node const *> strings(n_strings, b.create_str(s));
+	return b.create_seq(range<argdata_builder::node const *const>(strings.data(), strings.size()))->encode();
+}
+
+void run(bench::environment const &env, char const *name, std::string const &line) {
+	std::vector<unsigned char> input = make_input(line);
+	range<unsigned char const> data(input.data(), input.size());
+	std::vector<unsigned char> copy(input.size());
+	double mb = double(input.size()) / 1e6;
+	// Text of the same size, without the type tags, lengths and null bytes
+	// of the encoded strings.
+	std::string text;
+	while (text.size() < input.size()) text += line;
+	range<unsigned char const> chars(reinterpret_cast<unsigned char const *>(text.data()), text.size());
+	double text_mb = double(text.size()) / 1e6;
+
+	bench::check(env, argdata_validate(argdata_view(data)), "valid input is rejected");
+	bench::check(env, argdata_validate_utf8(chars) && scalar_utf8(chars.begin(), chars.end()),
+		"valid UTF-8 is rejected");
+	// Break the last string with a lone continuation byte.
+	std::vector<unsigned char> broken = input;
+	broken[broken.size() - 2] = 0x80;
+	bench::check(env, !argdata_validate(argdata_view(range<unsigned char const>(broken.data(), broken.size()))),
+		"invalid UTF-8 is accepted");
+
+	double t_validate = bench::measure([&] { bench::keep(argdata_validate(argdata_view(data))); });
+	double t_simd = bench::measure([&] { bench::keep(argdata_validate_utf8(chars)); });
+	double t_scalar = bench::measure([&] { bench::keep(scalar_utf8(chars.begin(), chars.end())); });
+	double t_memcpy = bench::measure([&] {
+		std::memcpy(copy.data(), input.data(), input.size());
+		bench::keep(copy);
+	});
+
+	std::string what = std::string(name) + ": ";
+	bench::report(env, (what + "argdata_validate, " SIMD).c_str(), mb / t_validate * 1e9, "MB/s");
+	bench::report(env, (what + "argdata_validate_utf8, " SIMD).c_str(), text_mb / t_simd * 1e9, "MB/s");
+	bench::report(env, (what + "scalar UTF-8 check").c_str(), text_mb / t_scalar * 1e9, "MB/s");
+	bench::report(env, (what + "memcpy").c_str(), mb / t_memcpy * 1e9, "MB/s");
+}
+
+}
+
+void program_main(argdata_t const *ad) {
+	bench::environment env = bench::parse(ad);
+	run(env, "ascii", "The quick brown fox jumps over the lazy dog. ");
+	run(env, "mixed", "Sch\xc3\xb6ne Gr\xc3\xbc\xc3\x9f" "e, \xe2\x82\xac" "5 \xf0\x9f\x98\x80 and some ASCII. ");
+	exit(0);
+}
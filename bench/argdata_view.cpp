@@ -0,0 +1,97 @@
+// Measures the cost per element of iterating over encoded maps and
+// sequences with argdata_t's iterators, which fix up pointers into
+// themselves whenever they are copied, and with argdata_view's, which are
+// trivially copyable. The loops use postfix increments, which copy the
+// iterator at every step.
+
+#include <cstdint>
+#include <vector>
+
+#include <cloudabi/argdata_builder.hpp>
+#include <cloudabi/argdata_view.hpp>
+
+#include "bench.hpp"
+
+namespace {
+
+constexpr int n_elements = 10000;
+
+struct totals {
+	std::uintmax_t keys = 0;
+	std::intmax_t values = 0;
+
+	friend bool operator==(totals const &a, totals const &b) {
+		return a.keys == b.keys && a.values == b.values;
+	}
+};
+
+totals sum_map(argdata_t const *value) {
+	totals t;
+	auto map = value->as_map();
+	for (auto i = map.begin(); i != map.end(); i++) {
+		t.keys += i->first->as_str().size();
+		t.values += i->second->as_int();
+	}
+	return t;
+}
+
+totals sum_map(argdata_view value) {
+	totals t;
+	auto map = value.as_map();
+	for (auto i = map.begin(); i != map.end(); i++) {
+		t.keys += i->first.as_str().size();
+		t.values += i->second.as_int();
+	}
+	return t;
+}
+
+totals sum_seq(argdata_t const *value) {
+	totals t;
+	auto seq = value->as_seq();
+	for (auto i = seq.begin(); i != seq.end(); i++) t.values += (*i)->as_int();
+	return t;
+}
+
+totals sum_seq(argdata_view value) {
+	totals t;
+	auto seq = value.as_seq();
+	for (auto i = seq.begin(); i != seq.end(); i++) t.values += (*i).as_int();
+	return t;
+}
+
+}
+
+void program_main(argdata_t const *ad) {
+	bench::environment env = bench::parse(ad);
+
+	using node = argdata_builder::node;
+	argdata_builder b(1 << 20);
+	std::vector<node const *> keys, values;
+	for (int i = 0; i < n_elements; ++i) {
+		keys.push_back(b.create_str(i % 2 ? "odd" : "even"));
+		values.push_back(b.create_int(i));
+	}
+	std::vector<unsigned char> map = b.create_map(
+		range<node const *const>(keys.data(), keys.size()),
+		range<node const *const>(values.data(), values.size()))->encode();
+	std::vector<unsigned char> seq = b.create_seq(
+		range<node const *const>(values.data(), values.size()))->encode();
+
+	auto map_t = argdata_t::create_encoded(range<unsigned char>(map.data(), map.size()));
+	auto seq_t = argdata_t::create_encoded(range<unsigned char>(seq.data(), seq.size()));
+	argdata_view map_v(range<unsigned char const>(map.data(), map.size()));
+	argdata_view seq_v(range<unsigned char const>(seq.data(), seq.size()));
+	bench::check(env, sum_map(map_t.get()) == sum_map(map_v), "argdata_view iterates maps differently");
+	bench::check(env, sum_seq(seq_t.get()) == sum_seq(seq_v), "argdata_view iterates sequences differently");
+
+	double t_map_t = bench::measure([&] { bench::keep(sum_map(map_t.get())); });
+	double t_map_v = bench::measure([&] { bench::keep(sum_map(map_v)); });
+	double t_seq_t = bench::measure([&] { bench::keep(sum_seq(seq_t.get())); });
+	double t_seq_v = bench::measure([&] { bench::keep(sum_seq(seq_v)); });
+
+	bench::report(env, "argdata_t: map iteration", t_map_t / n_elements, "ns/element");
+	bench::report(env, "argdata_view: map iteration", t_map_v / n_elements, "ns/element");
+	bench::report(env, "argdata_t: seq iteration", t_seq_t / n_elements, "ns/element");
+	bench::report(env, "argdata_view: seq iteration", t_seq_v / n_elements, "ns/element");
+	exit(0);
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+// Helpers shared by the benchmarks.
+//
+// Every benchmark is a CloudABI program, started by cloudabi-run with a map
+// like the following, and writes one line per measurement to the terminal:
+//
+//   %TAG ! tag:nuxi.nl,2015:cloudabi/
+//   ---
+//   terminal: !fd stdout
+//   tmpdir: !file
+//     path: /tmp
+//
+// Benchmarks that need files create them in tmpdir, and remove them again.
+// Every benchmark also checks the results it measures, and exits with a
+// status of one if they are wrong.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <mstd/string_view.hpp>
+
+// Before program.h, as it fixes up argdata.h for C++.
+#include <cloudabi/argdata.hpp>
+#include <program.h>
+
+#include <cloudabi/clock.hpp>
+#include <cloudabi/error_or.hpp>
+#include <cloudabi/fd.hpp>
+#include <cloudabi/fd_impl.hpp>
+#include <cloudabi/iovec.hpp>
+#include <cloudabi/types.hpp>
+
+namespace bench {
+
+using mstd::string_view;
+
+struct environment {
+	int terminal = -1;
+	cloudabi::fd tmpdir;
+};
+
+inline environment parse(argdata_t const *ad) {
+	environment env;
+	for (auto const &kv : ad->as_map()) {
+		string_view key = kv.first->as_str();
+		if (key == "terminal") {
+			env.terminal = kv.second->as_fd();
+		} else if (key == "tmpdir") {
+			env.tmpdir = cloudabi::fd(kv.second->as_fd());
+		}
+	}
+	return env;
+}
+
+inline cloudabi::timestamp now() {
+	auto t = cloudabi::clock_time_get(cloudabi::clockid::monotonic);
+	return t ? *t : 0;
+}
+
+// Keeps the compiler from optimizing away the computation of value.
+template<typename T>
+inline void keep(T const &value) {
+	asm volatile("" : : "r"(&value) : "memory");
+}
+
+// Runs f once to warm up, and then repeatedly for at least min_time
+// nanoseconds. Returns the average time of a single run in nanoseconds.
+template<typename F>
+double measure(F &&f, cloudabi::timestamp min_time = 500000000) {
+	f();
+	std::uint64_t runs = 0;
+	cloudabi::timestamp start = now();
+	cloudabi::timestamp elapsed;
+	do {
+		f();
+		++runs;
+		elapsed = now() - start;
+	} while (elapsed < min_time);
+	return double(elapsed) / double(runs);
+}
+
+inline void report(environment const &env, char const *what, double value, char const *unit) {
+	dprintf(env.terminal, "%-48s %14.2f %s\n", what, value, unit);
+}
+
+[[noreturn]] inline void fail(environment const &env, char const *what) {
+	dprintf(env.terminal, "FAILED: %s\n", what);
+	exit(1);
+}
+
+inline void check(environment const &env, bool ok, char const *what) {
+	if (!ok) fail(env, what);
+}
+
+// Creates a file of the given size in tmpdir, filled with lines of text, and
+// returns it opened with the rights that the benchmarks need.
+inline cloudabi::unique_fd create_file(environment const &env, string_view name, cloudabi::filesize size) {
+	using cloudabi::rights;
+	check(env, bool(env.tmpdir), "tmpdir is missing");
+	cloudabi::fd dir = env.tmpdir;
+	auto file = dir.file_open(name,
+		rights::fd_read | rights::fd_write | rights::fd_datasync |
+		rights::file_advise | rights::file_allocate | rights::file_stat_fget |
+		rights::file_stat_fput_size | rights::mem_map,
+		cloudabi::oflags::creat | cloudabi::oflags::trunc);
+	check(env, bool(file), "can't create a file in tmpdir");
+	cloudabi::fd f = file->get();
+	std::vector<unsigned char> chunk;
+	for (unsigned line = 0; chunk.size() < (1 << 20); ++line) {
+		char text[64];
+		int n = snprintf(text, sizeof(text), "line %u of the benchmark input\n", line);
+		chunk.insert(chunk.end(), text, text + n);
+	}
+	for (cloudabi::filesize offset = 0; offset < size;) {
+		std::size_t n = std::size_t(std::min<cloudabi::filesize>(chunk.size(), size - offset));
+		auto written = f.pwrite(cloudabi::ciovec(chunk.data(), n), offset);
+		check(env, written && *written > 0, "can't write a file in tmpdir");
+		offset += *written;
+	}
+	return std::move(*file);
+}
+
+inline void remove_file(environment const &env, string_view name) {
+	cloudabi::fd dir = env.tmpdir;
+	dir.file_unlink(name);
+}
+
+}
@@ -0,0 +1,137 @@
+// Measures how many syscalls buffered_writer and buffered_reader save for
+// programs that handle text a line at a time, and what that does to
+// throughput.
+//
+// The writer writes to a datagram socket, so that the reading side can count
+// write syscalls exactly, as every write is a datagram of its own. The
+// reader reads a regular file in tmpdir, and counts its reads by watching the
+// amount of buffered data grow.
+
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <cloudabi/buffered.hpp>
+
+#include "bench.hpp"
+
+namespace {
+
+constexpr int n_lines = 100000;
+constexpr cloudabi::filesize file_size = 4 << 20;
+constexpr std::size_t buffer_size = 16384;
+
+struct received {
+	std::uint64_t datagrams = 0;
+	std::uint64_t bytes = 0;
+};
+
+// Writes n_lines lines to a socket, either with a write syscall per line
+// or through a buffered_writer, while another thread receives them.
+received write_lines(bench::environment const &env, bool buffered) {
+	auto pair = cloudabi::fd::create2(cloudabi::filetype::socket_dgram);
+	bench::check(env, bool(pair), "can't create a socket pair");
+	cloudabi::fd out = pair->first.get();
+	cloudabi::fd in = pair->second.get();
+
+	char const line[] = "a line of text, as a log would have\n";
+	cloudabi::ciovec data(line, sizeof(line) - 1);
+	std::uint64_t total = std::uint64_t(n_lines) * data.size();
+
+	// Failures exit, so the reader doesn't have to be stopped.
+	received r;
+	std::thread reader([&] {
+		std::vector<unsigned char> buffer(buffer_size);
+		while (r.bytes < total) {
+			auto n = in.read(cloudabi::iovec(buffer.data(), buffer.size()));
+			bench::check(env, n && *n > 0, "can't read from the socket");
+			++r.datagrams;
+			r.bytes += *n;
+		}
+	});
+
+	if (buffered) {
+		cloudabi::buffered_writer w(out, buffer_size);
+		for (int i = 0; i < n_lines; ++i) {
+			bench::check(env, bool(w.write(data)), "can't write to the socket");
+		}
+		bench::check(env, bool(w.flush()), "can't write to the socket");
+	} else {
+		for (int i = 0; i < n_lines; ++i) {
+			auto n = out.write(data);
+			bench::check(env, n && *n == data.size(), "can't write to the socket");
+		}
+	}
+	reader.join();
+	bench::check(env, r.bytes == total, "the socket received the wrong data");
+	return r;
+}
+
+struct lines {
+	std::uint64_t count = 0;
+	std::uint64_t reads = 0;
+};
+
+// Reads a line at a time, one byte per read syscall, as a program without
+// any buffering would.
+lines read_naive(bench::environment const &env, cloudabi::fd file) {
+	lines l;
+	bench::check(env, bool(file.seek(0, cloudabi::whence::set)), "can't seek");
+	for (;;) {
+		unsigned char c;
+		auto n = file.read(cloudabi::iovec(&c, 1));
+		bench::check(env, bool(n), "can't read the file");
+		++l.reads;
+		if (*n == 0) break;
+		if (c == '\n') ++l.count;
+	}
+	return l;
+}
+
+lines read_buffered(bench::environment const &env, cloudabi::fd file) {
+	lines l;
+	bench::check(env, bool(file.seek(0, cloudabi::whence::set)), "can't seek");
+	cloudabi::buffered_reader r(file, buffer_size);
+	for (;;) {
+		std::size_t before = r.buffered().size();
+		auto line = r.read_until('\n');
+		bench::check(env, bool(line), "can't read the file");
+		// Lines are much shorter than the buffer, so every call reads at
+		// most once.
+		if (r.buffered().size() + line->size() > before) ++l.reads;
+		if (line->size() == 0) break;
+		// The file may end in the middle of a line.
+		if (line->data()[line->size() - 1] == '\n') ++l.count;
+	}
+	// The read that found the end of the file didn't move the end.
+	++l.reads;
+	return l;
+}
+
+}
+
+void program_main(argdata_t const *ad) {
+	bench::environment env = bench::parse(ad);
+
+	received raw, buffered;
+	double t_raw = bench::measure([&] { raw = write_lines(env, false); });
+	double t_buffered = bench::measure([&] { buffered = write_lines(env, true); });
+	bench::report(env, "write per line: syscalls", double(raw.datagrams), "writes");
+	bench::report(env, "buffered_writer: syscalls", double(buffered.datagrams), "writes");
+	bench::report(env, "write per line: throughput", t_raw / n_lines, "ns/line");
+	bench::report(env, "buffered_writer: throughput", t_buffered / n_lines, "ns/line");
+
+	char const name[] = "bench_buffered";
+	cloudabi::unique_fd file = bench::create_file(env, name, file_size);
+	lines naive, with_reader;
+	double t_naive = bench::measure([&] { naive = read_naive(env, file.get()); });
+	double t_reader = bench::measure([&] { with_reader = read_buffered(env, file.get()); });
+	bench::remove_file(env, name);
+	bench::check(env, naive.count == with_reader.count, "buffered_reader finds a different number of lines");
+	bench::report(env, "read per byte: syscalls", double(naive.reads), "reads");
+	bench::report(env, "buffered_reader: syscalls", double(with_reader.reads), "reads");
+	bench::report(env, "read per byte: throughput", t_naive / double(naive.count), "ns/line");
+	bench::report(env, "buffered_reader: throughput", t_reader / double(with_reader.count), "ns/line");
+	exit(0);
+}
@@ -0,0 +1,64 @@
+// Measures how copy_file() scales with the number of threads, in both
+// copy modes, copying a file in tmpdir to another one.
+//
+// Both files stay in the page cache, so this mostly measures how well the
+// copying itself is spread over the threads.
+
+#include <cstring>
+#include <vector>
+
+#include <cloudabi/file_copy.hpp>
+
+#include "bench.hpp"
+
+namespace {
+
+constexpr cloudabi::filesize file_size = 128 << 20;
+
+bool same_contents(cloudabi::fd a, cloudabi::fd b) {
+	std::vector<unsigned char> x(1 << 20), y(1 << 20);
+	for (cloudabi::filesize offset = 0;;) {
+		auto n = a.pread(cloudabi::iovec(x.data(), x.size()), offset);
+		auto m = b.pread(cloudabi::iovec(y.data(), y.size()), offset);
+		if (!n || !m || *n != *m) return false;
+		if (*n == 0) return true;
+		if (std::memcmp(x.data(), y.data(), *n) != 0) return false;
+		offset += *n;
+	}
+}
+
+}
+
+void program_main(argdata_t const *ad) {
+	bench::environment env = bench::parse(ad);
+
+	char const source_name[] = "bench_file_copy_source";
+	char const target_name[] = "bench_file_copy_target";
+	cloudabi::unique_fd source = bench::create_file(env, source_name, file_size);
+	cloudabi::unique_fd target = bench::create_file(env, target_name, 0);
+	double mb = double(file_size) / 1e6;
+
+	for (cloudabi::copy_mode mode : {cloudabi::copy_mode::read, cloudabi::copy_mode::mem_map}) {
+		char const *mode_name = mode == cloudabi::copy_mode::read ? "read" : "mem_map";
+		for (std::size_t threads : {1, 2, 4, 8}) {
+			cloudabi::copy_options options;
+			options.threads = threads;
+			options.mode = mode;
+			bool ok = true;
+			double t = bench::measure([&] {
+				auto n = cloudabi::copy_file(source.get(), target.get(), options);
+				ok = ok && n && *n == file_size;
+			});
+			bench::check(env, ok, "copy_file() fails");
+			bench::check(env, same_contents(source.get(), target.get()), "copy_file() copies the wrong data");
+
+			char what[64];
+			snprintf(what, sizeof(what), "copy_file(), %s, threads: %zu", mode_name, threads);
+			bench::report(env, what, mb / t * 1e9, "MB/s");
+		}
+	}
+
+	bench::remove_file(env, source_name);
+	bench::remove_file(env, target_name);
+	exit(0);
+}
@@ -0,0 +1,80 @@
+// Measures scanning a file in tmpdir front to back with mapped_reader,
+// against reading it into a buffer with pread(). Every scan counts the
+// newlines in the file, so that the data is actually touched.
+//
+// The file is in the page cache once it has been created, except for the
+// parts that drop_behind drops, which is why that runs last. This mostly
+// measures the cost of getting the data into the program, not that of the
+// disk.
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <cloudabi/mapped_reader.hpp>
+
+#include "bench.hpp"
+
+namespace {
+
+constexpr cloudabi::filesize file_size = 64 << 20;
+
+std::uint64_t count_newlines(range<unsigned char const> data) {
+	return std::uint64_t(std::count(data.begin(), data.end(), '\n'));
+}
+
+std::uint64_t scan_mapped(bench::environment const &env, cloudabi::fd file, bool drop_behind) {
+	cloudabi::mapped_reader r(file, 16 << 20, drop_behind);
+	std::uint64_t lines = 0;
+	for (;;) {
+		auto data = r.next();
+		bench::check(env, bool(data), "mapped_reader can't read the file");
+		if (data->size() == 0) break;
+		lines += count_newlines(*data);
+		r.consume(data->size());
+	}
+	return lines;
+}
+
+std::uint64_t scan_pread(bench::environment const &env, cloudabi::fd file, std::vector<unsigned char> &buffer) {
+	std::uint64_t lines = 0;
+	for (cloudabi::filesize offset = 0;;) {
+		auto n = file.pread(cloudabi::iovec(buffer.data(), buffer.size()), offset);
+		bench::check(env, bool(n), "can't read the file");
+		if (*n == 0) break;
+		lines += count_newlines(range<unsigned char const>(buffer.data(), *n));
+		offset += *n;
+	}
+	return lines;
+}
+
+}
+
+void program_main(argdata_t const *ad) {
+	bench::environment env = bench::parse(ad);
+
+	char const name[] = "bench_mapped_reader";
+	cloudabi::unique_fd file = bench::create_file(env, name, file_size);
+	cloudabi::fd f = file.get();
+	std::vector<unsigned char> small(64 << 10), large(1 << 20);
+
+	std::uint64_t expected = scan_pread(env, f, large);
+	bench::check(env, expected > 0, "the file has no lines");
+	bench::check(env, scan_pread(env, f, small) == expected, "pread() finds a different number of lines");
+	bench::check(env, scan_mapped(env, f, false) == expected, "mapped_reader finds a different number of lines");
+
+	double mb = double(file_size) / 1e6;
+	double t_small = bench::measure([&] { bench::keep(scan_pread(env, f, small)); });
+	double t_large = bench::measure([&] { bench::keep(scan_pread(env, f, large)); });
+	double t_mapped = bench::measure([&] { bench::keep(scan_mapped(env, f, false)); });
+	bench::check(env, scan_mapped(env, f, true) == expected,
+		"mapped_reader with drop_behind finds a different number of lines");
+	double t_drop = bench::measure([&] { bench::keep(scan_mapped(env, f, true)); });
+	bench::remove_file(env, name);
+
+	bench::report(env, "pread(), 64 KiB buffer", mb / t_small * 1e9, "MB/s");
+	bench::report(env, "pread(), 1 MiB buffer", mb / t_large * 1e9, "MB/s");
+	bench::report(env, "mapped_reader", mb / t_mapped * 1e9, "MB/s");
+	bench::report(env, "mapped_reader, drop_behind", mb / t_drop * 1e9, "MB/s");
+	exit(0);
+}
@@ -0,0 +1,108 @@
+// Measures sending and receiving batches of small messages over a datagram
+// socket pair with sock_send_batch() and recv_batch, against a loop that
+// sends every message by itself, and receives it into buffers allocated for
+// that message alone. Both are measured without file descriptors, and with
+// one file descriptor attached to every message.
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <cloudabi/sock_batch.hpp>
+
+#include "bench.hpp"
+
+namespace {
+
+constexpr std::size_t batch_size = 32;
+constexpr std::size_t message_size = 64;
+
+// The messages of a batch, which start with their index.
+struct batch {
+	std::vector<unsigned char> data;
+	std::vector<cloudabi::ciovec> iovecs;
+	std::vector<cloudabi::send_in> messages;
+
+	explicit batch(cloudabi::fd const *attached)
+		: data(batch_size * message_size), iovecs(batch_size), messages(batch_size) {
+		for (std::size_t i = 0; i < batch_size; ++i) {
+			unsigned char *m = data.data() + i * message_size;
+			std::uint32_t index = std::uint32_t(i);
+			std::memcpy(m, &index, sizeof(index));
+			iovecs[i] = cloudabi::ciovec(m, message_size);
+			messages[i].si_data = range<cloudabi::ciovec const>(iovecs[i]);
+			if (attached) messages[i].si_fds = range<cloudabi::fd const>(attached, 1);
+			messages[i].si_flags = cloudabi::msgflags::none;
+		}
+	}
+};
+
+bool check_message(range<unsigned char const> data, std::size_t index, std::size_t fds, std::size_t expected_fds) {
+	std::uint32_t i;
+	if (data.size() != message_size || fds != expected_fds) return false;
+	std::memcpy(&i, data.data(), sizeof(i));
+	return i == index;
+}
+
+bool send_receive_naive(cloudabi::fd out, cloudabi::fd in, batch const &b, std::size_t n_fds) {
+	for (cloudabi::send_in const &m : b.messages) {
+		if (!out.sock_send(m)) return false;
+	}
+	bool ok = true;
+	for (std::size_t i = 0; i < batch_size; ++i) {
+		std::vector<unsigned char> data(message_size);
+		std::vector<cloudabi::fd> fds(n_fds);
+		cloudabi::iovec iov(data.data(), data.size());
+		cloudabi::recv_in ri;
+		ri.ri_data = range<cloudabi::iovec const>(iov);
+		ri.ri_fds = range<cloudabi::fd>(fds.data(), fds.size());
+		ri.ri_flags = cloudabi::msgflags::none;
+		auto r = in.sock_recv(ri);
+		if (!r) return false;
+		for (std::size_t j = 0; j < r->ro_fdslen; ++j) fds[j].close();
+		ok = ok && check_message(range<unsigned char const>(data.data(), r->ro_datalen), i, r->ro_fdslen, n_fds);
+	}
+	return ok;
+}
+
+bool send_receive_batched(cloudabi::fd out, cloudabi::fd in, batch const &b, cloudabi::recv_batch &rb, std::size_t n_fds) {
+	auto sent = cloudabi::sock_send_batch(out, range<cloudabi::send_in const>(b.messages.data(), b.messages.size()));
+	if (!sent || *sent != batch_size) return false;
+	// All messages are known to be available, so a blocking socket only
+	// blocks for the first one, if at all.
+	auto received = rb.receive(in, batch_size);
+	if (!received || *received != batch_size) return false;
+	bool ok = true;
+	for (std::size_t i = 0; i < batch_size; ++i) {
+		ok = ok && check_message(rb[i].data, i, rb[i].fds.size(), n_fds);
+	}
+	return ok;
+}
+
+}
+
+void program_main(argdata_t const *ad) {
+	bench::environment env = bench::parse(ad);
+
+	auto pair = cloudabi::fd::create2(cloudabi::filetype::socket_dgram);
+	bench::check(env, bool(pair), "can't create a socket pair");
+	cloudabi::fd out = pair->first.get();
+	cloudabi::fd in = pair->second.get();
+	cloudabi::recv_batch rb(batch_size, message_size, 1);
+
+	for (std::size_t n_fds = 0; n_fds <= 1; ++n_fds) {
+		// Any file descriptor will do.
+		batch b(n_fds ? &out : nullptr);
+		bench::check(env, send_receive_naive(out, in, b, n_fds), "a message per syscall receives the wrong data");
+		bench::check(env, send_receive_batched(out, in, b, rb, n_fds), "recv_batch receives the wrong data");
+
+		double t_naive = bench::measure([&] { bench::keep(send_receive_naive(out, in, b, n_fds)); });
+		double t_batched = bench::measure([&] { bench::keep(send_receive_batched(out, in, b, rb, n_fds)); });
+
+		char const *naive = n_fds ? "a message at a time, one fd each" : "a message at a time";
+		char const *batched = n_fds ? "sock_send_batch/recv_batch, one fd each" : "sock_send_batch/recv_batch";
+		bench::report(env, naive, batch_size / t_naive * 1e3, "Mmsg/s");
+		bench::report(env, batched, batch_size / t_batched * 1e3, "Mmsg/s");
+	}
+	exit(0);
+}
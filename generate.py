@@ -208,8 +208,6 @@ cpp_skip = {
     'auxtype',
     'auxv',
     'ciovec',
-    'dircookie',
-    'dirent',
     'fd',
     'lookup',
     'iovec',
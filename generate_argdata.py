@@ -0,0 +1,493 @@
+#!/usr/bin/env python3
+# Copyright (c) 2016 Nuxi (https://nuxi.nl/) and contributors.
+#
+# This file is distributed under a 2-clause BSD license.
+# See the LICENSE and CONTRIBUTORS files for details.
+
+# Generates C++ structs with specialized argdata decoders and encoders from
+# a schema.
+#
+# Usage: generate_argdata.py schema.txt > schema.hpp
+#
+# A schema is a list of structs, each with a list of fields, which are
+# encoded as an argdata map with string keys:
+#
+#   struct route
+#     str destination
+#     uint metric
+#     seq str tags
+#     route_options options
+#
+# Field types are bool, int, uint, float, str, binary, fd, any struct that
+# is defined before, and seq followed by another type. Strings and binary
+# values are decoded as views into the encoded buffer. File descriptors are
+# decoded as their index in the fd list. Unknown keys are ignored, and
+# missing keys leave a field at its default value.
+
+import sys
+
+
+class ScalarType:
+
+    def __init__(self, name, cpptype, default, tag, getter, size):
+        self.name = name
+        self.cpptype = cpptype
+        self.default = default
+        self.tag = tag
+        self.getter = getter
+        # Encoded size, if it does not depend on the value.
+        self.size = size
+
+
+class StructRef:
+
+    def __init__(self, struct):
+        self.name = struct.name
+        self.cpptype = struct.name
+        self.default = None
+        self.size = None
+
+
+class SeqType:
+
+    def __init__(self, element_type):
+        self.element_type = element_type
+        self.cpptype = 'std::vector<{}>'.format(element_type.cpptype)
+        self.default = None
+        self.size = None
+
+
+SCALAR_TYPES = {t.name: t for t in [
+    ScalarType('bool', 'bool', 'false', 'bool_', 'get_bool', None),
+    ScalarType('int', 'std::int64_t', '0', 'int_', 'get_int', None),
+    ScalarType('uint', 'std::uint64_t', '0', 'int_', 'get_uint', None),
+    ScalarType('float', 'double', '0.0', 'float_', 'get_float', 9),
+    ScalarType('str', 'string_view', None, 'str', 'get_str', None),
+    ScalarType('binary', 'range<unsigned char const>', None, 'binary',
+               'get_binary', None),
+    ScalarType('fd', 'int', '-1', 'fd', 'get_fd', 5),
+]}
+
+
+class Field:
+
+    def __init__(self, type, name):
+        self.type = type
+        self.name = name
+
+
+class Struct:
+
+    def __init__(self, name):
+        self.name = name
+        self.fields = []
+
+
+class SchemaParser:
+
+    def parse(self, f):
+        structs = {}
+        result = []
+        current = None
+        for lineno, line in enumerate(f, 1):
+            line = line.split('#', 1)[0].rstrip()
+            if not line:
+                continue
+            words = line.split()
+            try:
+                if not line[0].isspace():
+                    if len(words) != 2 or words[0] != 'struct':
+                        raise Exception('Expected struct declaration')
+                    if words[1] in structs or words[1] in SCALAR_TYPES:
+                        raise Exception('Duplicate struct name')
+                    current = Struct(words[1])
+                    structs[current.name] = current
+                    result.append(current)
+                else:
+                    if current is None or len(words) < 2:
+                        raise Exception('Expected field declaration')
+                    if any(f.name == words[-1] for f in current.fields):
+                        raise Exception('Duplicate field name')
+                    current.fields.append(Field(
+                        self.parse_type(words[:-1], structs), words[-1]))
+            except Exception as e:
+                raise Exception('{}:{}: {}'.format(f.name, lineno, e))
+        return result
+
+    def parse_type(self, words, structs):
+        if words[0] == 'seq' and len(words) > 1:
+            return SeqType(self.parse_type(words[1:], structs))
+        if len(words) != 1:
+            raise Exception('Invalid type: {}'.format(' '.join(words)))
+        if words[0] in SCALAR_TYPES:
+            return SCALAR_TYPES[words[0]]
+        if words[0] in structs:
+            return StructRef(structs[words[0]])
+        raise Exception('Unknown type: {}'.format(words[0]))
+
+
+def subfield_length(n):
+    # Big endian base 128, with the top bit set in the last byte.
+    result = [n & 0x7f | 0x80]
+    n >>= 7
+    while n:
+        result.append(n & 0x7f)
+        n >>= 7
+    return bytes(reversed(result))
+
+
+def key_bytes(name):
+    # A map key as a complete subfield: length, tag and null terminated
+    # string.
+    value = bytes([8]) + name.encode() + b'\0'
+    return subfield_length(len(value)) + value
+
+
+def uses_fds(type):
+    # Whether encoding a value of the type can add to the list of file
+    # descriptors.
+    if isinstance(type, SeqType):
+        return uses_fds(type.element_type)
+    return isinstance(type, StructRef) or type.name == 'fd'
+
+
+def c_string(data):
+    # Octal escapes are at most three digits, so unlike hexadecimal ones they
+    # can't consume the characters that follow.
+    return '"{}"'.format(''.join(
+        chr(b) if b < 0x80 and (chr(b).isalnum() or b == ord('_')) else '\\{:03o}'.format(b)
+        for b in data))
+
+
+class CppArgdataGenerator:
+
+    def generate(self, structs):
+        print('#pragma once\n')
+        print('#include <algorithm>')
+        print('#include <cstddef>')
+        print('#include <cstdint>')
+        print('#include <cstring>')
+        print('#include <vector>\n')
+        print('#include <mstd/optional.hpp>')
+        print('#include <mstd/range.hpp>')
+        print('#include <mstd/string_view.hpp>\n')
+        print('#include <cloudabi/argdata_format.hpp>')
+        print('#include <cloudabi/argdata_view.hpp>\n')
+        print('// Generated by generate_argdata.py. Do not edit.\n')
+        for s in structs:
+            self.generate_struct(s)
+
+    def generate_struct(self, s):
+        print('struct {} {{\n'.format(s.name))
+        for f in s.fields:
+            if f.type.default is None:
+                print('\t{} {};'.format(f.type.cpptype, f.name))
+            else:
+                print('\t{} {} = {};'.format(
+                    f.type.cpptype, f.name, f.type.default))
+        print()
+        self.generate_decode(s)
+        print()
+        self.generate_encoded_size(s)
+        print()
+        self.generate_measure(s)
+        print()
+        self.generate_encode_into(s)
+        print()
+        print('\tvoid encode(std::vector<unsigned char> &out, '
+              'std::vector<int> &fds) const {')
+        print('\t\tstd::vector<std::size_t> sizes;')
+        print('\t\tmeasure(sizes);')
+        print('\t\tout.resize(sizes[0]);')
+        print('\t\tstd::size_t const *next = sizes.data() + 1;')
+        print('\t\tencode_into(out.data(), fds, next);')
+        print('\t}')
+        print('\n};\n')
+
+    # Decoding.
+
+    def generate_decode(self, s):
+        print('\t// Returns nullopt if value is not a map, or if a known key '
+              'has a value of')
+        print('\t// the wrong type.')
+        print('\tstatic optional<{0}> decode(argdata_view value) {{'.format(
+            s.name))
+        print('\t\tauto contents = value.get_map_contents();')
+        print('\t\tif (!contents) return {};')
+        print('\t\t{} result;'.format(s.name))
+        print('\t\tunsigned char const *pos = contents->data();')
+        print('\t\tunsigned char const *end = pos + contents->size();')
+        print('\t\twhile (pos != end) {')
+        print('\t\t\tstd::size_t key_len, value_len;')
+        print('\t\t\tif (!argdata_format::read_subfield_length(pos, end, '
+              'key_len)) return {};')
+        print('\t\t\tunsigned char const *key = pos;')
+        print('\t\t\tpos += key_len;')
+        print('\t\t\tif (!argdata_format::read_subfield_length(pos, end, '
+              'value_len)) return {};')
+        print('\t\t\targdata_view v(range<unsigned char const>'
+              '(pos, value_len));')
+        print('\t\t\tpos += value_len;')
+        print('\t\t\t// String keys are a tag, the characters and a null '
+              'byte.')
+        print('\t\t\tif (key_len < 3 || key[0] != (unsigned char)'
+              'argdata_format::tag::str || key[key_len - 1] != 0) continue;')
+        by_length = {}
+        for f in s.fields:
+            by_length.setdefault(len(f.name), {}).setdefault(
+                f.name[0], []).append(f)
+        print('\t\t\tswitch (key_len - 2) {')
+        for length in sorted(by_length):
+            print('\t\t\tcase {}:'.format(length))
+            print('\t\t\t\tswitch (key[1]) {')
+            for first in sorted(by_length[length]):
+                print("\t\t\t\tcase '{}':".format(first))
+                for f in by_length[length][first]:
+                    if length > 1:
+                        print('\t\t\t\t\tif (std::memcmp(key + 2, {}, {}) == 0) '
+                              '{{'.format(c_string(f.name[1:].encode()),
+                                          length - 1))
+                    else:
+                        print('\t\t\t\t\t{')
+                    self.generate_decode_value(
+                        f.type, 'v', 'result.' + f.name, '\t\t\t\t\t\t', 0)
+                    print('\t\t\t\t\t}')
+                print('\t\t\t\t\tbreak;')
+            print('\t\t\t\t}')
+            print('\t\t\t\tbreak;')
+        print('\t\t\t}')
+        print('\t\t}')
+        print('\t\treturn result;')
+        print('\t}')
+
+    def generate_decode_value(self, type, view, target, indent, depth):
+        if isinstance(type, ScalarType):
+            print('{}if (auto x = {}.{}()) {} = {}(*x); else return {{}};'.format(
+                indent, view, type.getter, target, type.cpptype))
+        elif isinstance(type, StructRef):
+            print('{}if (auto x = {}::decode({})) {} = *x; '
+                  'else return {{}};'.format(indent, type.name, view, target))
+        else:
+            seq = 's{}'.format(depth)
+            element = 'e{}'.format(depth)
+            print('{}auto {} = {}.get_seq();'.format(indent, seq, view))
+            print('{}if (!{}) return {{}};'.format(indent, seq))
+            print('{}{}.clear();'.format(indent, target))
+            print('{}for (argdata_view {} : *{}) {{'.format(
+                indent, element, seq))
+            print('{}\t{}.emplace_back();'.format(indent, target))
+            self.generate_decode_value(
+                type.element_type, element, target + '.back()', indent + '\t',
+                depth + 1)
+            print('{}}}'.format(indent))
+
+    # Encoding.
+
+    # Keys, and values with a fixed size, are summed up in advance.
+    def fixed_size(self, s):
+        fixed = 1
+        for f in s.fields:
+            fixed += len(key_bytes(f.name))
+            if f.type.size is not None:
+                fixed += 1 + f.type.size
+        return fixed
+
+    def generate_encoded_size(self, s):
+        print('\tstd::size_t encoded_size() const {')
+        print('\t\tstd::size_t n = {};'.format(self.fixed_size(s)))
+        for f in s.fields:
+            if f.type.size is None:
+                self.generate_size_value(
+                    f.type, 'this->' + f.name, 'n', '\t\t', 0)
+        print('\t\treturn n;')
+        print('\t}')
+
+    def size_expression(self, type, value):
+        if type.size is not None:
+            return str(type.size)
+        if isinstance(type, StructRef):
+            return '{}.encoded_size()'.format(value)
+        if isinstance(type, SeqType):
+            # Only sequences of values with a fixed size can be measured
+            # without looking at every element.
+            size = type.element_type.size
+            if size is None:
+                return None
+            return '1 + {}.size() * {}'.format(
+                value, len(subfield_length(size)) + size)
+        if isinstance(type, ScalarType):
+            return {
+                'bool': '({} ? 2 : 1)',
+                'int': '1 + argdata_format::int_size({})',
+                'uint': '1 + argdata_format::uint_size({})',
+                'str': '2 + {}.size()',
+                'binary': '1 + {}.size()',
+            }[type.name].format(value)
+        return None
+
+    # Adds the size of a value, including its subfield length, to total.
+    def generate_size_value(self, type, value, total, indent, depth):
+        size = 'm{}'.format(depth)
+        print('{}{{'.format(indent))
+        expression = self.size_expression(type, value)
+        if expression is not None:
+            print('{}\tstd::size_t {} = {};'.format(indent, size, expression))
+        else:
+            element = 'e{}'.format(depth)
+            print('{}\tstd::size_t {} = 1;'.format(indent, size))
+            print('{}\tfor (auto const &{} : {})'.format(
+                indent, element, value))
+            self.generate_size_value(
+                type.element_type, element, size, indent + '\t', depth + 1)
+        print('{}\t{} += argdata_format::subfield_length_size({}) + {};'.format(
+            indent, total, size, size))
+        print('{}}}'.format(indent))
+
+    # Encoding needs the size of every struct and sequence for its subfield
+    # length. Asking every one of them for its encoded_size() would measure
+    # the innermost values once for every level around them, so they are
+    # measured in a single pass instead, in the order in which they are
+    # encoded.
+
+    def generate_measure(self, s):
+        print('\t// Appends the encoded sizes of this struct, and of the '
+              'structs and sequences')
+        print('\t// in it, to sizes, in the order in which encode_into() '
+              'needs them.')
+        print('\tvoid measure(std::vector<std::size_t> &sizes) const {')
+        print('\t\tstd::size_t i = sizes.size();')
+        print('\t\tsizes.push_back(0);')
+        print('\t\tstd::size_t n = {};'.format(self.fixed_size(s)))
+        for f in s.fields:
+            if f.type.size is None:
+                self.generate_measure_value(
+                    f.type, 'this->' + f.name, 'n', '\t\t', 0)
+        print('\t\tsizes[i] = n;')
+        print('\t}')
+
+    # Adds the size of a value, including its subfield length, to total, and
+    # appends the sizes of structs and sequences to sizes.
+    def generate_measure_value(self, type, value, total, indent, depth):
+        size = 'm{}'.format(depth)
+        index = 'i{}'.format(depth)
+        print('{}{{'.format(indent))
+        if isinstance(type, StructRef):
+            print('{}\tstd::size_t {} = sizes.size();'.format(indent, index))
+            print('{}\t{}.measure(sizes);'.format(indent, value))
+            print('{}\tstd::size_t {} = sizes[{}];'.format(indent, size, index))
+        elif isinstance(type, SeqType):
+            element = 'e{}'.format(depth)
+            print('{}\tstd::size_t {} = sizes.size();'.format(indent, index))
+            print('{}\tsizes.push_back(0);'.format(indent))
+            expression = self.size_expression(type, value)
+            if expression is not None:
+                print('{}\tstd::size_t {} = {};'.format(
+                    indent, size, expression))
+            else:
+                print('{}\tstd::size_t {} = 1;'.format(indent, size))
+                print('{}\tfor (auto const &{} : {})'.format(
+                    indent, element, value))
+                self.generate_measure_value(
+                    type.element_type, element, size, indent + '\t',
+                    depth + 1)
+            print('{}\tsizes[{}] = {};'.format(indent, index, size))
+        else:
+            print('{}\tstd::size_t {} = {};'.format(
+                indent, size, self.size_expression(type, value)))
+        print('{}\t{} += argdata_format::subfield_length_size({}) + {};'.format(
+            indent, total, size, size))
+        print('{}}}'.format(indent))
+
+    def generate_encode_into(self, s):
+        print('\t// Writes encoded_size() bytes to out, and adds the file '
+              'descriptors to fds.')
+        print('\tunsigned char *encode_into(unsigned char *out, '
+              'std::vector<int> &fds) const {')
+        print('\t\tstd::vector<std::size_t> sizes;')
+        print('\t\tmeasure(sizes);')
+        print('\t\tstd::size_t const *next = sizes.data() + 1;')
+        print('\t\treturn encode_into(out, fds, next);')
+        print('\t}')
+        print()
+        print('\t// Like the above, taking the sizes that measure() gave, '
+              'starting right after')
+        print('\t// the size of this struct. Advances next past the sizes '
+              'it used.')
+        # Parameters that a struct doesn't use are left unnamed, so that
+        # the generated code compiles without warnings.
+        print('\tunsigned char *encode_into(unsigned char *out, '
+              'std::vector<int> &{}, std::size_t const *&{}) const {{'.format(
+                  'fds' if any(uses_fds(f.type) for f in s.fields) else '',
+                  'next' if any(f.type.size is None and
+                                not isinstance(f.type, ScalarType)
+                                for f in s.fields) else ''))
+        print('\t\t*out++ = (unsigned char)argdata_format::tag::map;')
+        for f in s.fields:
+            key = key_bytes(f.name)
+            print('\t\tstd::memcpy(out, {}, {});'.format(c_string(key), len(key)))
+            print('\t\tout += {};'.format(len(key)))
+            self.generate_encode_value(f.type, 'this->' + f.name, '\t\t', 0)
+        print('\t\treturn out;')
+        print('\t}')
+
+    # Writes a value, prefixed by its subfield length.
+    def generate_encode_value(self, type, value, indent, depth):
+        if isinstance(type, (StructRef, SeqType)):
+            print('{}out = argdata_format::write_subfield_length(out, '
+                  '*next++);'.format(indent))
+        else:
+            print('{}out = argdata_format::write_subfield_length(out, {});'.format(
+                indent, self.size_expression(type, value)))
+        if isinstance(type, StructRef):
+            print('{}out = {}.encode_into(out, fds, next);'.format(indent, value))
+            return
+        if isinstance(type, SeqType):
+            element = 'e{}'.format(depth)
+            print('{}*out++ = (unsigned char)argdata_format::tag::seq;'.format(
+                indent))
+            print('{}for (auto const &{} : {}) {{'.format(indent, element, value))
+            self.generate_encode_value(
+                type.element_type, element, indent + '\t', depth + 1)
+            print('{}}}'.format(indent))
+            return
+        print('{}*out++ = (unsigned char)argdata_format::tag::{};'.format(
+            indent, type.tag))
+        if type.name == 'bool':
+            print('{}if ({}) *out++ = 1;'.format(indent, value))
+        elif type.name == 'int':
+            print('{}out = argdata_format::write_int(out, std::uintmax_t({}), '
+                  'argdata_format::int_size({}));'.format(indent, value, value))
+        elif type.name == 'uint':
+            print('{}out = argdata_format::write_int(out, {}, '
+                  'argdata_format::uint_size({}));'.format(indent, value, value))
+        elif type.name == 'float':
+            print('{}out = argdata_format::write_float(out, {});'.format(
+                indent, value))
+        elif type.name == 'fd':
+            print('{}{{'.format(indent))
+            print('{}\tauto i = std::find(fds.begin(), fds.end(), {});'.format(
+                indent, value))
+            print('{}\tif (i == fds.end()) i = fds.insert(i, {});'.format(
+                indent, value))
+            print('{}\tout = argdata_format::write_fd(out, '
+                  'std::uint32_t(i - fds.begin()));'.format(indent))
+            print('{}}}'.format(indent))
+        elif type.name == 'str':
+            # An empty value's data may be a null pointer.
+            print('{}if ({}.size()) std::memcpy(out, {}.data(), '
+                  '{}.size());'.format(indent, value, value, value))
+            print('{}out += {}.size();'.format(indent, value))
+            print('{}*out++ = 0;'.format(indent))
+        elif type.name == 'binary':
+            print('{}if ({}.size()) std::memcpy(out, {}.data(), '
+                  '{}.size());'.format(indent, value, value, value))
+            print('{}out += {}.size();'.format(indent, value))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        print('usage: {} schema.txt'.format(sys.argv[0]), file=sys.stderr)
+        sys.exit(1)
+    with open(sys.argv[1]) as f:
+        structs = SchemaParser().parse(f)
+    CppArgdataGenerator().generate(structs)
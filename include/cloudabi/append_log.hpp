@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <mstd/range.hpp>
+
+#include "error_or.hpp"
+#include "fd.hpp"
+#include "fd_impl.hpp"
+#include "iovec.hpp"
+#include "types.hpp"
+
+namespace cloudabi {
+
+using mstd::range;
+
+struct append_log_options {
+	// How long a commit waits for more records to join it. Longer delays
+	// give fewer, larger commits, at the cost of the latency of every
+	// append.
+	std::chrono::microseconds max_delay{0};
+	// A commit stops waiting for more records once it has this many bytes.
+	size_t batch_bytes = 1 << 20;
+	// The file is allocated ahead of the data in steps of this size. Zero
+	// disables allocating.
+	filesize segment_size = 64 << 20;
+	// The maximum number of ciovecs passed to a single write.
+	size_t max_iovecs = 1024;
+};
+
+// An append-only file, such as a write-ahead log, written by many threads
+// with group commit.
+//
+// Every append() blocks until its record is durable. Records appended while
+// another commit is in progress are collected into the next commit, which is
+// done by whichever of their threads gets there first: a single vectored
+// write of all records in the group, followed by a single datasync. Records
+// are borrowed, not copied, as their threads wait anyway.
+//
+// Records are numbered in the order they are written to the file. Since the
+// file is allocated ahead of the data, its size doesn't mark the end of the
+// log, so records need framing that tells where they end when the log is
+// read back. After a failed commit, the contents of the file past the last
+// durable record are unknown, and all further appends fail.
+//
+// Does not own the file descriptor, and doesn't use its offset.
+class append_log {
+
+public:
+	using sequence = std::uint64_t;
+
+	// Appends to the file from the given offset, such as the end of the last
+	// valid record found when the log was opened.
+	explicit append_log(fd file, filesize end = 0, append_log_options options = {})
+		: fd_(file), options_(std::move(options)), end_(end), allocated_(end) {}
+
+	fd get_fd() const { return fd_; }
+
+	// Appends a record, and returns its sequence number once it is durable.
+	error_or<sequence> append(ciovec record) {
+		return append(range<ciovec const>(record));
+	}
+
+	// Appends a record made of multiple parts.
+	error_or<sequence> append(range<ciovec const> record);
+
+	// The sequence number of the last durable record, or zero if there is
+	// none yet.
+	sequence durable() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return durable_;
+	}
+
+	// The offset in the file right after the last durable record.
+	filesize end() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return end_;
+	}
+
+private:
+	struct batch {
+		std::vector<ciovec> iovecs;
+		size_t bytes = 0;
+		sequence last = 0;
+	};
+
+	fd fd_;
+	append_log_options options_;
+
+	mutable std::mutex mutex_;
+	// Wakes the thread that is collecting the next commit.
+	std::condition_variable more_;
+	// Wakes the threads waiting for a commit to finish.
+	std::condition_variable done_;
+
+	batch open_;
+	bool committing_ = false;
+	sequence next_ = 0;
+	sequence durable_ = 0;
+	error_or<void> broken_;
+	filesize end_;
+
+	// Only used by the committing thread.
+	filesize allocated_;
+
+	// Writes and syncs a batch at the given offset. Returns the offset right
+	// after it.
+	error_or<filesize> commit(batch &b, filesize offset) {
+		filesize end = offset + b.bytes;
+		if (options_.segment_size > 0 && end > allocated_) {
+			filesize s = options_.segment_size;
+			filesize to = (end + s - 1) / s * s;
+			// Only an optimization, so failure is ignored.
+			fd_.file_allocate(allocated_, to - allocated_);
+			allocated_ = to;
+		}
+		size_t i = 0;
+		while (i < b.iovecs.size()) {
+			size_t n = std::min(b.iovecs.size() - i, options_.max_iovecs);
+			auto written = fd_.pwrite(range<ciovec const>(b.iovecs.data() + i, n), offset);
+			if (!written) return written.error();
+			// Records are never empty, so this would otherwise loop forever.
+			if (*written == 0) return error::io;
+			offset += *written;
+			size_t left = *written;
+			while (i < b.iovecs.size() && left >= b.iovecs[i].size()) {
+				left -= b.iovecs[i].size();
+				++i;
+			}
+			if (left > 0) b.iovecs[i] = ciovec(b.iovecs[i].data() + left, b.iovecs[i].size() - left);
+		}
+		auto r = fd_.datasync();
+		if (!r) return r.error();
+		return offset;
+	}
+
+};
+
+inline error_or<append_log::sequence> append_log::append(range<ciovec const> record) {
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (!broken_) return broken_.error();
+	sequence seq = ++next_;
+	for (ciovec const &part : record) {
+		if (part.size() == 0) continue;
+		open_.iovecs.push_back(part);
+		open_.bytes += part.size();
+	}
+	open_.last = seq;
+	more_.notify_one();
+	for (;;) {
+		if (durable_ >= seq) return seq;
+		if (!broken_) return broken_.error();
+		if (committing_) {
+			done_.wait(lock);
+			continue;
+		}
+		// No commit is in progress, so this record is still in the open
+		// batch, and this thread commits it.
+		committing_ = true;
+		if (options_.max_delay.count() > 0) {
+			more_.wait_for(lock, options_.max_delay,
+				[this] { return open_.bytes >= options_.batch_bytes; });
+		}
+		batch b;
+		std::swap(b, open_);
+		filesize offset = end_;
+		lock.unlock();
+		auto r = commit(b, offset);
+		lock.lock();
+		committing_ = false;
+		if (r) {
+			end_ = *r;
+			durable_ = b.last;
+		} else {
+			broken_ = r.error();
+		}
+		done_.notify_all();
+	}
+}
+
+}
@@ -200,7 +200,7 @@ public:
 		friend seq;
 	public:
 		seq_iterator() {}
-		seq_iterator(map_iterator const &other) { *this = other; }
+		seq_iterator(seq_iterator const &other) { *this = other; }
 		seq_iterator &operator=(seq_iterator const &other) {
 			it_ = other.it_;
 			value_ = other.value_;
@@ -0,0 +1,400 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <mstd/range.hpp>
+#include <mstd/string_view.hpp>
+
+#include "argdata.hpp"
+#include "argdata_format.hpp"
+
+// Builds argdata trees inside an arena.
+//
+// argdata_t::create_*() allocate every node separately, and create_map() and
+// create_seq() need the caller to keep the arrays of children alive. The
+// builder instead places all nodes, strings and child arrays in large blocks
+// that it owns. Nodes are never freed individually: clearing or destroying
+// the builder releases all of them at once.
+//
+// Encoding a tree gives exactly the same bytes as encoding the equivalent
+// tree of argdata_t nodes.
+class argdata_builder {
+
+public:
+	class node;
+
+	explicit argdata_builder(std::size_t block_size = 4096) : block_size_(block_size) {}
+
+	argdata_builder(argdata_builder const &) = delete;
+	argdata_builder &operator=(argdata_builder const &) = delete;
+
+	// Invalidate all nodes, but keep the memory around for reuse.
+	void clear() {
+		current_ = 0;
+		pos_ = end_ = nullptr;
+		if (!blocks_.empty()) {
+			pos_ = blocks_[0].data.get();
+			end_ = pos_ + blocks_[0].size;
+		}
+	}
+
+	node const *create_binary(range<unsigned char const> r);
+	node const *create_fd(int v);
+	node const *create_float(double v);
+	node const *create_int(std::uintmax_t v);
+	node const *create_int(std::intmax_t v);
+	node const *create_int(int v) { return create_int(std::intmax_t(v)); }
+	node const *create_str(string_view v);
+
+	// Copies an already encoded value. File descriptors in it are written
+	// as they are, so their indices refer to the fd list of the original.
+	node const *create_encoded(range<unsigned char const> r);
+
+	// Unlike argdata_t::create_map() and create_seq(), these copy the
+	// pointers to the children into the arena, so the given arrays do not
+	// need to outlive the node.
+
+	node const *create_map(
+		range<node const *const> keys,
+		range<node const *const> values
+	);
+	node const *create_map(std::initializer_list<std::pair<node const *, node const *>> entries);
+
+	node const *create_seq(range<node const *const> values);
+	node const *create_seq(std::initializer_list<node const *> values) {
+		return create_seq(range<node const *const>(values.begin(), values.size()));
+	}
+
+	static node const *false_();
+	static node const *true_ ();
+	static node const *null  ();
+
+	static node const *bool_(bool v) { return v ? true_() : false_(); }
+
+private:
+	struct block {
+		std::unique_ptr<unsigned char[]> data;
+		std::size_t size;
+	};
+
+	std::size_t block_size_;
+	std::vector<block> blocks_;
+	std::size_t current_ = 0;
+	unsigned char *pos_ = nullptr;
+	unsigned char *end_ = nullptr;
+
+	void *allocate(std::size_t size, std::size_t align) {
+		std::uintptr_t p = (std::uintptr_t(pos_) + align - 1) & ~std::uintptr_t(align - 1);
+		if (!pos_ || size > std::uintptr_t(end_) - p || p > std::uintptr_t(end_)) {
+			return allocate_slow(size, align);
+		}
+		pos_ = reinterpret_cast<unsigned char *>(p + size);
+		return reinterpret_cast<void *>(p);
+	}
+
+	void *allocate_slow(std::size_t size, std::size_t align) {
+		// Continue with the next block that is big enough, if clear() left
+		// any behind. Otherwise, allocate a new one.
+		std::size_t needed = size + align - 1;
+		std::size_t i = pos_ ? current_ + 1 : 0;
+		while (i < blocks_.size() && blocks_[i].size < needed) ++i;
+		if (i == blocks_.size()) {
+			std::size_t n = std::max(needed, block_size_);
+			blocks_.push_back(block{std::unique_ptr<unsigned char[]>(new unsigned char[n]), n});
+		}
+		current_ = i;
+		pos_ = blocks_[i].data.get();
+		end_ = pos_ + blocks_[i].size;
+		return allocate(size, align);
+	}
+
+	template<typename T>
+	T *allocate_array(std::size_t n) {
+		return static_cast<T *>(allocate(n * sizeof(T), alignof(T)));
+	}
+
+	template<typename... Args>
+	node *new_node(Args &&... args);
+
+};
+
+class argdata_builder::node {
+
+private:
+	enum class kind : unsigned char { null, binary, bool_, encoded, fd, float_, int_, uint, map, seq, str };
+
+	kind kind_;
+
+	// Number of bytes for binary, encoded and str, number of elements for map and seq.
+	std::size_t size_ = 0;
+
+	// Encoded length, and the number of fd nodes, of the whole subtree.
+	std::size_t length_ = 0;
+	std::size_t n_fds_ = 0;
+
+	union {
+		unsigned char const *data_;
+		node const *const *children_;
+		std::uintmax_t int_;
+		double float_;
+		int fd_;
+		bool bool_;
+	};
+
+	explicit node(kind k) : kind_(k), data_(nullptr) {}
+	node(kind k, bool v) : kind_(k), bool_(v) { compute_length(); }
+
+	friend argdata_builder;
+
+	// Maps store their keys and values interleaved.
+	range<node const *const> children() const {
+		return {children_, kind_ == kind::map ? 2 * size_ : size_};
+	}
+
+	// Computes the encoded length of this node. Nodes are immutable once
+	// created, so this is done only once per node, and every encode() of a
+	// tree containing this node reuses it.
+	void compute_length() {
+		using namespace argdata_format;
+		n_fds_ = 0;
+		switch (kind_) {
+			case kind::null:   length_ = 0; break;
+			case kind::binary: length_ = 1 + size_; break;
+			case kind::bool_:  length_ = bool_ ? 2 : 1; break;
+			case kind::encoded: length_ = size_; break;
+			case kind::fd:     length_ = 5; n_fds_ = 1; break;
+			case kind::float_: length_ = 9; break;
+			case kind::int_:   length_ = 1 + int_size(std::intmax_t(int_)); break;
+			case kind::uint:   length_ = 1 + uint_size(int_); break;
+			case kind::str:    length_ = 2 + size_; break;
+			case kind::map:
+			case kind::seq:
+				length_ = 1;
+				for (node const *c : children()) {
+					length_ += subfield_length_size(c->length_) + c->length_;
+					n_fds_ += c->n_fds_;
+				}
+				break;
+		}
+	}
+
+	unsigned char *write(unsigned char *out, std::vector<int> &fds) const {
+		using namespace argdata_format;
+		switch (kind_) {
+			case kind::null:
+				return out;
+			case kind::binary:
+				*out++ = (unsigned char)tag::binary;
+				if (size_) std::memcpy(out, data_, size_);
+				return out + size_;
+			case kind::bool_:
+				*out++ = (unsigned char)tag::bool_;
+				if (bool_) *out++ = 1;
+				return out;
+			case kind::encoded:
+				if (size_) std::memcpy(out, data_, size_);
+				return out + size_;
+			case kind::fd: {
+				*out++ = (unsigned char)tag::fd;
+				auto i = std::find(fds.begin(), fds.end(), fd_);
+				if (i == fds.end()) i = fds.insert(i, fd_);
+				return write_fd(out, std::uint32_t(i - fds.begin()));
+			}
+			case kind::float_:
+				*out++ = (unsigned char)tag::float_;
+				return write_float(out, float_);
+			case kind::int_:
+				*out++ = (unsigned char)tag::int_;
+				return write_int(out, int_, int_size(std::intmax_t(int_)));
+			case kind::uint:
+				*out++ = (unsigned char)tag::int_;
+				return write_int(out, int_, uint_size(int_));
+			case kind::str:
+				*out++ = (unsigned char)tag::str;
+				if (size_) std::memcpy(out, data_, size_);
+				out += size_;
+				*out++ = '\0';
+				return out;
+			case kind::map:
+			case kind::seq:
+				*out++ = (unsigned char)(kind_ == kind::map ? tag::map : tag::seq);
+				for (node const *c : children()) {
+					out = write_subfield_length(out, c->length_);
+					out = c->write(out, fds);
+				}
+				return out;
+		}
+		return out;
+	}
+
+public:
+	node(node const &) = delete;
+	node &operator=(node const &) = delete;
+
+	// n_fds is set to the number of file descriptor nodes, which is an upper
+	// bound on the number of file descriptors that encode() returns.
+	std::size_t encoded_size(std::size_t *n_fds = nullptr) const {
+		if (n_fds) *n_fds = n_fds_;
+		return length_;
+	}
+
+	// Encodes into the first encoded_size() bytes of buffer in a single pass,
+	// and appends the file descriptors to fds. Returns the number of bytes
+	// written, or zero if buffer is too small.
+	std::size_t encode_into(range<unsigned char> buffer, std::vector<int> &fds) const {
+		if (buffer.size() < length_) return 0;
+		write(buffer.data(), fds);
+		return length_;
+	}
+
+	// These reuse the capacity of buffer and fds, so keeping them around
+	// between messages avoids reallocating them.
+
+	void encode(std::vector<unsigned char> &buffer) const {
+		std::vector<int> fds;
+		encode(buffer, fds);
+	}
+
+	void encode(std::vector<unsigned char> &buffer, std::vector<int> &fds) const {
+		buffer.resize(length_);
+		fds.clear();
+		fds.reserve(n_fds_);
+		write(buffer.data(), fds);
+	}
+
+	std::vector<unsigned char> encode(std::vector<int> *fds = nullptr) const {
+		std::vector<unsigned char> buffer;
+		if (fds) encode(buffer, *fds);
+		else encode(buffer);
+		return buffer;
+	}
+
+};
+
+template<typename... Args>
+inline argdata_builder::node *argdata_builder::new_node(Args &&... args) {
+	return new (allocate(sizeof(node), alignof(node))) node(std::forward<Args>(args)...);
+}
+
+inline argdata_builder::node const *argdata_builder::create_binary(range<unsigned char const> r) {
+	node *n = new_node(node::kind::binary);
+	unsigned char *data = allocate_array<unsigned char>(r.size());
+	if (r.size()) std::memcpy(data, r.data(), r.size());
+	n->size_ = r.size();
+	n->data_ = data;
+	n->compute_length();
+	return n;
+}
+
+inline argdata_builder::node const *argdata_builder::create_encoded(range<unsigned char const> r) {
+	node *n = new_node(node::kind::encoded);
+	unsigned char *data = allocate_array<unsigned char>(r.size());
+	if (r.size()) std::memcpy(data, r.data(), r.size());
+	n->size_ = r.size();
+	n->data_ = data;
+	n->compute_length();
+	return n;
+}
+
+inline argdata_builder::node const *argdata_builder::create_fd(int v) {
+	node *n = new_node(node::kind::fd);
+	n->fd_ = v;
+	n->compute_length();
+	return n;
+}
+
+inline argdata_builder::node const *argdata_builder::create_float(double v) {
+	node *n = new_node(node::kind::float_);
+	n->float_ = v;
+	n->compute_length();
+	return n;
+}
+
+inline argdata_builder::node const *argdata_builder::create_int(std::uintmax_t v) {
+	node *n = new_node(node::kind::uint);
+	n->int_ = v;
+	n->compute_length();
+	return n;
+}
+
+inline argdata_builder::node const *argdata_builder::create_int(std::intmax_t v) {
+	node *n = new_node(node::kind::int_);
+	n->int_ = std::uintmax_t(v);
+	n->compute_length();
+	return n;
+}
+
+inline argdata_builder::node const *argdata_builder::create_str(string_view v) {
+	node *n = new_node(node::kind::str);
+	char *data = allocate_array<char>(v.size());
+	if (v.size()) std::memcpy(data, v.data(), v.size());
+	n->size_ = v.size();
+	n->data_ = reinterpret_cast<unsigned char const *>(data);
+	n->compute_length();
+	return n;
+}
+
+inline argdata_builder::node const *argdata_builder::create_map(
+	range<node const *const> keys,
+	range<node const *const> values
+) {
+	std::size_t size = keys.size() < values.size() ? keys.size() : values.size();
+	node const **children = allocate_array<node const *>(2 * size);
+	for (std::size_t i = 0; i < size; ++i) {
+		children[2 * i] = keys[i];
+		children[2 * i + 1] = values[i];
+	}
+	node *n = new_node(node::kind::map);
+	n->size_ = size;
+	n->children_ = children;
+	n->compute_length();
+	return n;
+}
+
+inline argdata_builder::node const *argdata_builder::create_map(
+	std::initializer_list<std::pair<node const *, node const *>> entries
+) {
+	node const **children = allocate_array<node const *>(2 * entries.size());
+	node const **c = children;
+	for (auto const &e : entries) {
+		*c++ = e.first;
+		*c++ = e.second;
+	}
+	node *n = new_node(node::kind::map);
+	n->size_ = entries.size();
+	n->children_ = children;
+	n->compute_length();
+	return n;
+}
+
+inline argdata_builder::node const *argdata_builder::create_seq(range<node const *const> values) {
+	node const **children = allocate_array<node const *>(values.size());
+	std::copy(values.begin(), values.end(), children);
+	node *n = new_node(node::kind::seq);
+	n->size_ = values.size();
+	n->children_ = children;
+	n->compute_length();
+	return n;
+}
+
+inline argdata_builder::node const *argdata_builder::false_() {
+	static node const n(node::kind::bool_, false);
+	return &n;
+}
+
+inline argdata_builder::node const *argdata_builder::true_() {
+	static node const n(node::kind::bool_, true);
+	return &n;
+}
+
+inline argdata_builder::node const *argdata_builder::null() {
+	static node const n(node::kind::null);
+	return &n;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include <mstd/range.hpp>
+
+#include "argdata.hpp"
+#include "argdata_format.hpp"
+#include "iovec.hpp"
+
+// Encodes argdata as a list of ciovecs, for fd::write() or send_in::si_data,
+// without copying large strings and binary values.
+//
+// Type tags, lengths and small values are written to a scratch buffer owned
+// by the encoder. Strings and binary values of at least copy_threshold bytes
+// are referred to in place, so they must outlive the ciovecs. The encoder is
+// meant to be reused, so its buffers only grow once.
+class argdata_ciovec_encoder {
+
+public:
+	explicit argdata_ciovec_encoder(std::size_t copy_threshold = 256)
+		: copy_threshold_(copy_threshold) {}
+
+	// Encodes value. The result is valid until the next call to encode(), and
+	// is the same data that argdata_t::encode() gives, split over ciovecs.
+	std::vector<cloudabi::ciovec> const &encode(argdata_t const *value) {
+		scratch_.clear();
+		segments_.clear();
+		fds_.clear();
+		sizes_.clear();
+		measure(value);
+		std::size_t len = sizes_[0].len;
+		add(0, value);
+		iovecs_.clear();
+		unsigned char const *s = scratch_.data();
+		for (segment const &seg : segments_) {
+			if (seg.data) {
+				iovecs_.emplace_back(seg.data, seg.size);
+			} else {
+				iovecs_.emplace_back(s, seg.size);
+				s += seg.size;
+			}
+		}
+		size_ = len;
+		return iovecs_;
+	}
+
+	std::vector<cloudabi::ciovec> const &ciovecs() const { return iovecs_; }
+
+	// The file descriptors referred to by the last encoded value.
+	std::vector<int> const &fds() const { return fds_; }
+
+	// The total number of bytes of the last encoded value.
+	std::size_t size() const { return size_; }
+
+private:
+	// A range outside of the scratch buffer, or, if data is null, the next
+	// size bytes of it. The scratch buffer may move while encoding, so
+	// ciovecs are only made at the end.
+	struct segment {
+		unsigned char const *data;
+		std::size_t size;
+	};
+
+	// The encoded size of a value and the number of file descriptors in it,
+	// in pre-order. end is the index right after the sizes of its children.
+	struct size_info {
+		std::size_t len;
+		std::size_t n_fds;
+		std::size_t end;
+	};
+
+	std::size_t copy_threshold_;
+	std::vector<unsigned char> scratch_;
+	std::vector<segment> segments_;
+	std::vector<cloudabi::ciovec> iovecs_;
+	std::vector<int> fds_;
+	std::vector<size_info> sizes_;
+	std::size_t size_ = 0;
+
+	unsigned char *reserve(std::size_t n) {
+		if (segments_.empty() || segments_.back().data) segments_.push_back({nullptr, 0});
+		segments_.back().size += n;
+		scratch_.resize(scratch_.size() + n);
+		return scratch_.data() + scratch_.size() - n;
+	}
+
+	void put_tag(argdata_format::tag t) {
+		*reserve(1) = (unsigned char)t;
+	}
+
+	void put_length(std::size_t len) {
+		argdata_format::write_subfield_length(
+			reserve(argdata_format::subfield_length_size(len)), len);
+	}
+
+	// Computes the sizes of a value and everything in it in a single pass,
+	// as calling encoded_size() at every level would measure the innermost
+	// values once for every level around them. Returns the index of the
+	// value in sizes_.
+	std::size_t measure(argdata_t const *value) {
+		std::size_t i = sizes_.size();
+		sizes_.push_back({0, 0, 0});
+		std::size_t len = 1;
+		std::size_t n_fds = 0;
+		auto add_child = [&](argdata_t const *child) {
+			size_info const &c = sizes_[measure(child)];
+			len += argdata_format::subfield_length_size(c.len) + c.len;
+			n_fds += c.n_fds;
+		};
+		if (auto map = value->get_map()) {
+			for (auto const &kv : *map) {
+				add_child(kv.first);
+				add_child(kv.second);
+			}
+		} else if (auto seq = value->get_seq()) {
+			for (argdata_t const *v : *seq) add_child(v);
+		} else {
+			len = value->encoded_size(&n_fds);
+		}
+		sizes_[i] = {len, n_fds, sizes_.size()};
+		return i;
+	}
+
+	// Adds the child whose sizes are at index i, and returns the index of
+	// the next one.
+	std::size_t put_child(std::size_t i, argdata_t const *child) {
+		put_length(sizes_[i].len);
+		add(i, child);
+		return sizes_[i].end;
+	}
+
+	void add(std::size_t i, argdata_t const *value) {
+		std::size_t len = sizes_[i].len;
+		std::size_t n_fds = sizes_[i].n_fds;
+		// Small values without file descriptors are simply copied. Values
+		// with file descriptors can't be, as their indices would be relative
+		// to the value instead of the whole message.
+		if (n_fds == 0 && len < copy_threshold_) {
+			argdata_get_buffer(value, reserve(len), nullptr);
+		} else if (auto binary = value->get_binary()) {
+			put_tag(argdata_format::tag::binary);
+			segments_.push_back({binary->data(), binary->size()});
+		} else if (auto str = value->get_str()) {
+			put_tag(argdata_format::tag::str);
+			segments_.push_back({reinterpret_cast<unsigned char const *>(str->data()), str->size()});
+			*reserve(1) = '\0';
+		} else if (auto map = value->get_map()) {
+			put_tag(argdata_format::tag::map);
+			std::size_t child = i + 1;
+			for (auto const &kv : *map) {
+				child = put_child(child, kv.first);
+				child = put_child(child, kv.second);
+			}
+		} else if (auto seq = value->get_seq()) {
+			put_tag(argdata_format::tag::seq);
+			std::size_t child = i + 1;
+			for (argdata_t const *v : *seq) child = put_child(child, v);
+		} else if (auto fd = value->get_fd()) {
+			put_tag(argdata_format::tag::fd);
+			auto i = std::find(fds_.begin(), fds_.end(), *fd);
+			if (i == fds_.end()) i = fds_.insert(i, *fd);
+			argdata_format::write_fd(reserve(4), std::uint32_t(i - fds_.begin()));
+		} else {
+			// Any other type of value can't contain file descriptors.
+			argdata_get_buffer(value, reserve(len), nullptr);
+		}
+	}
+
+};
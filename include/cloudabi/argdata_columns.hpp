@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <mstd/optional.hpp>
+#include <mstd/range.hpp>
+#include <mstd/string_view.hpp>
+
+#include "argdata_format.hpp"
+#include "argdata_index.hpp"
+#include "argdata_view.hpp"
+
+enum class argdata_column_type { int_, float_, str };
+
+struct argdata_column {
+	string_view key;
+	argdata_column_type type;
+};
+
+// Extracts columns from an encoded sequence of maps, such as a batch of
+// records, into contiguous arrays of integers, floats or strings.
+//
+// Every map is a row. A column holds the values of one key in all rows, with
+// a validity flag per row that is zero if the key is missing, or if its value
+// has the wrong type. Missing values are zero or empty. Strings are views into
+// the encoded buffer, which must outlive them. Elements of the sequence that
+// are not maps are rows without any values.
+//
+// The set of keys is fixed when the extractor is created, and is best kept in
+// a static variable, as for argdata_key_set.
+template<std::size_t N>
+class argdata_columns {
+
+private:
+	std::array<argdata_column_type, N> types_;
+	string_view names_[N];
+	argdata_key_set<N> keys_;
+	std::size_t rows_ = 0;
+
+	// Only one of these is used by every column.
+	std::array<std::vector<std::int64_t>, N> ints_;
+	std::array<std::vector<double>, N> floats_;
+	std::array<std::vector<string_view>, N> strs_;
+	std::array<std::vector<unsigned char>, N> valid_;
+
+	string_view const (&names(argdata_column const (&columns)[N]))[N] {
+		for (std::size_t i = 0; i < N; ++i) names_[i] = columns[i].key;
+		return names_;
+	}
+
+	void resize(std::size_t rows) {
+		for (std::size_t c = 0; c < N; ++c) {
+			switch (types_[c]) {
+				case argdata_column_type::int_:   ints_[c].resize(rows);   break;
+				case argdata_column_type::float_: floats_[c].resize(rows); break;
+				case argdata_column_type::str:    strs_[c].resize(rows);   break;
+			}
+			valid_[c].resize(rows);
+		}
+	}
+
+	// Fills in a row that has been reset to zero already. Returns false if the
+	// map is malformed.
+	bool decode_row(std::size_t row, argdata_view element) {
+		auto contents = element.get_map_contents();
+		if (!contents) return true;
+		unsigned char const *pos = contents->data();
+		unsigned char const *end = pos + contents->size();
+		while (pos != end) {
+			std::size_t key_len, value_len;
+			if (!argdata_format::read_subfield_length(pos, end, key_len)) return false;
+			auto key = argdata_view(range<unsigned char const>(pos, key_len)).get_str();
+			pos += key_len;
+			if (!argdata_format::read_subfield_length(pos, end, value_len)) return false;
+			argdata_view value(range<unsigned char const>(pos, value_len));
+			pos += value_len;
+			if (!key) continue;
+			std::size_t c = keys_.lookup(*key);
+			// Like argdata_key_set::find_all(), the first occurrence of a key
+			// counts, even if its value has the wrong type.
+			if (c == N || valid_[c][row] != 0) continue;
+			valid_[c][row] = 2;
+			switch (types_[c]) {
+				case argdata_column_type::int_:
+					if (auto v = value.get_int()) {
+						ints_[c][row] = std::int64_t(*v);
+						valid_[c][row] = 1;
+					}
+					break;
+				case argdata_column_type::float_:
+					if (auto v = value.get_float()) {
+						floats_[c][row] = *v;
+						valid_[c][row] = 1;
+					}
+					break;
+				case argdata_column_type::str:
+					if (auto v = value.get_str()) {
+						strs_[c][row] = *v;
+						valid_[c][row] = 1;
+					}
+					break;
+			}
+		}
+		return true;
+	}
+
+	// Turns the marks of keys with values of the wrong type into zeroes.
+	void finish_rows(std::size_t begin, std::size_t end) {
+		for (std::size_t c = 0; c < N; ++c) {
+			for (std::size_t row = begin; row < end; ++row) valid_[c][row] &= 1;
+		}
+	}
+
+public:
+	explicit argdata_columns(argdata_column const (&columns)[N]) : keys_(names(columns)) {
+		for (std::size_t i = 0; i < N; ++i) types_[i] = columns[i].type;
+	}
+
+	// Extracts all columns from seq, replacing the previous contents. With
+	// n_threads above one, the rows are split into that many parts, which are
+	// decoded in parallel after a first pass that only finds the rows.
+	// Returns false if seq is not a sequence, or is malformed.
+	bool extract(argdata_view seq, unsigned n_threads = 1) {
+		rows_ = 0;
+		resize(0);
+		if (n_threads <= 1) {
+			auto contents = seq.get_seq_contents();
+			if (!contents) return false;
+			unsigned char const *begin = contents->data();
+			unsigned char const *end = begin + contents->size();
+			// Count the rows first, which only reads their lengths, so that
+			// the columns are resized once.
+			std::size_t rows = 0;
+			for (unsigned char const *pos = begin; pos != end; ++rows) {
+				std::size_t len;
+				if (!argdata_format::read_subfield_length(pos, end, len)) return false;
+				pos += len;
+			}
+			resize(rows);
+			unsigned char const *pos = begin;
+			for (std::size_t row = 0; row < rows; ++row) {
+				std::size_t len;
+				argdata_format::read_subfield_length(pos, end, len);
+				if (!decode_row(row, argdata_view(range<unsigned char const>(pos, len)))) {
+					resize(0);
+					return false;
+				}
+				pos += len;
+			}
+			finish_rows(0, rows);
+			rows_ = rows;
+			return true;
+		}
+
+		auto index = argdata_seq_index::create(seq);
+		if (!index) return false;
+		std::size_t rows = index->size();
+		resize(rows);
+		std::size_t part = (rows + n_threads - 1) / n_threads;
+		std::atomic<bool> ok(true);
+		auto decode_part = [&](std::size_t begin, std::size_t end) {
+			for (std::size_t row = begin; row < end; ++row) {
+				if (!decode_row(row, (*index)[row])) {
+					ok = false;
+					return;
+				}
+			}
+			finish_rows(begin, end);
+		};
+		std::vector<std::thread> threads;
+		for (std::size_t begin = part; begin < rows; begin += part) {
+			threads.emplace_back(decode_part, begin, std::min(begin + part, rows));
+		}
+		decode_part(0, std::min(part, rows));
+		for (std::thread &t : threads) t.join();
+		if (!ok) {
+			resize(0);
+			return false;
+		}
+		rows_ = rows;
+		return true;
+	}
+
+	std::size_t rows() const { return rows_; }
+
+	std::size_t columns() const { return N; }
+
+	argdata_column_type type(std::size_t column) const { return types_[column]; }
+
+	// The values of a column of the corresponding type. Empty for columns of
+	// another type.
+	std::vector<std::int64_t> const &ints(std::size_t column) const { return ints_[column]; }
+	std::vector<double> const &floats(std::size_t column) const { return floats_[column]; }
+	std::vector<string_view> const &strs(std::size_t column) const { return strs_[column]; }
+
+	// One for every row that has a value in this column, zero otherwise.
+	std::vector<unsigned char> const &valid(std::size_t column) const { return valid_[column]; }
+
+};
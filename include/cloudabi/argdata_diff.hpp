@@ -0,0 +1,406 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <mstd/optional.hpp>
+#include <mstd/range.hpp>
+#include <mstd/string_view.hpp>
+
+#include "argdata.hpp"
+#include "argdata_builder.hpp"
+#include "argdata_persistent.hpp"
+#include "argdata_view.hpp"
+
+// Structural diffs between argdata values, encoded as argdata themselves.
+//
+// A patch is a map, which turns an old value into a new one:
+//
+//  - An empty map leaves the value unchanged.
+//  - {"=": v} replaces the value by v.
+//  - {"m": {k: p, ...}, "d": [k, ...]} changes a map. Every key in "m" has
+//    its value patched by p, where a missing key counts as null, so that
+//    {"=": v} inserts it. Keys in "d" are deleted. New keys are added after
+//    the existing ones.
+//  - {"s": [op, ...]} changes a sequence. Every op is either [i, p], which
+//    patches the element at position i, or [i, n, [v, ...]], which replaces
+//    n elements starting at position i by the given values. Positions refer
+//    to the old sequence, and must be increasing and not overlap.
+//
+// Patches are only made for maps and sequences when they are smaller than
+// replacing the value as a whole. File descriptors are compared and copied
+// by their index, so those in a patch refer to the fd list of the new value.
+// Maps with duplicate keys, or whose remaining keys changed order, are
+// replaced as a whole, so that applying a patch reproduces the new value
+// exactly. Values nested deeper than max_depth are replaced as a whole too,
+// and patches nested deeper than that are rejected.
+
+namespace argdata_diff_detail {
+
+constexpr std::size_t max_depth = 128;
+
+inline bool equal(argdata_view a, argdata_view b) {
+	auto x = a.encoded(), y = b.encoded();
+	return x.size() == y.size() &&
+		(x.size() == 0 || std::memcmp(x.data(), y.data(), x.size()) == 0);
+}
+
+inline bool less(argdata_view a, argdata_view b) {
+	auto x = a.encoded(), y = b.encoded();
+	return std::lexicographical_compare(x.begin(), x.end(), y.begin(), y.end());
+}
+
+struct entry {
+	argdata_view key;
+	argdata_view value;
+};
+
+// The entries of a map sorted by key, keeping only the first occurrence of
+// every key.
+inline std::vector<entry> sorted_entries(argdata_view::map map) {
+	std::vector<entry> entries;
+	for (auto const &kv : map) entries.push_back({kv.first, kv.second});
+	std::stable_sort(entries.begin(), entries.end(),
+		[](entry const &a, entry const &b) { return less(a.key, b.key); });
+	entries.erase(std::unique(entries.begin(), entries.end(),
+		[](entry const &a, entry const &b) { return equal(a.key, b.key); }), entries.end());
+	return entries;
+}
+
+inline std::vector<entry> entries(argdata_view::map map) {
+	std::vector<entry> entries;
+	for (auto const &kv : map) entries.push_back({kv.first, kv.second});
+	return entries;
+}
+
+inline bool contains(std::vector<entry> const &sorted, argdata_view key) {
+	auto i = std::lower_bound(sorted.begin(), sorted.end(), key,
+		[](entry const &e, argdata_view k) { return less(e.key, k); });
+	return i != sorted.end() && equal(i->key, key);
+}
+
+inline std::vector<argdata_view> elements(argdata_view::seq seq) {
+	return std::vector<argdata_view>(seq.begin(), seq.end());
+}
+
+using node = argdata_builder::node;
+
+inline node const *unchanged(argdata_builder &b) {
+	return b.create_map({});
+}
+
+inline node const *replace(argdata_view to, argdata_builder &b) {
+	return b.create_map({{b.create_str("="), b.create_encoded(to.encoded())}});
+}
+
+node const *diff(argdata_view from, argdata_view to, argdata_builder &b, std::size_t depth);
+
+// Returns nullptr if the map can't be patched into the new one exactly.
+inline node const *diff_map(argdata_view::map from, argdata_view::map to, argdata_builder &b, std::size_t depth) {
+	auto a = entries(from);
+	auto c = entries(to);
+	auto a_sorted = sorted_entries(from);
+	auto c_sorted = sorted_entries(to);
+	if (a_sorted.size() != a.size() || c_sorted.size() != c.size()) return nullptr;
+	// Patching keeps the remaining keys in place and adds new ones at the
+	// end, so the new map must start with the remaining keys, in order.
+	std::vector<node const *> keys, patches, deleted;
+	std::size_t kept = 0;
+	for (entry const &e : a) {
+		if (!contains(c_sorted, e.key)) {
+			deleted.push_back(b.create_encoded(e.key.encoded()));
+			continue;
+		}
+		if (!equal(c[kept].key, e.key)) return nullptr;
+		if (!equal(c[kept].value, e.value)) {
+			keys.push_back(b.create_encoded(e.key.encoded()));
+			patches.push_back(diff(e.value, c[kept].value, b, depth + 1));
+		}
+		++kept;
+	}
+	for (std::size_t j = kept; j < c.size(); ++j) {
+		keys.push_back(b.create_encoded(c[j].key.encoded()));
+		patches.push_back(replace(c[j].value, b));
+	}
+	std::vector<node const *> fields, values;
+	if (!keys.empty()) {
+		fields.push_back(b.create_str("m"));
+		values.push_back(b.create_map(keys, patches));
+	}
+	if (!deleted.empty()) {
+		fields.push_back(b.create_str("d"));
+		values.push_back(b.create_seq(deleted));
+	}
+	return b.create_map(fields, values);
+}
+
+inline node const *diff_seq(argdata_view::seq from, argdata_view::seq to, argdata_builder &b, std::size_t depth) {
+	auto a = elements(from);
+	auto c = elements(to);
+	// Only the part between the common prefix and suffix differs. Elements
+	// at the same position in it are patched, and the remainder is spliced.
+	std::size_t n = std::min(a.size(), c.size());
+	std::size_t prefix = 0;
+	while (prefix < n && equal(a[prefix], c[prefix])) ++prefix;
+	std::size_t suffix = 0;
+	while (suffix < n - prefix && equal(a[a.size() - 1 - suffix], c[c.size() - 1 - suffix])) ++suffix;
+	std::size_t a_end = a.size() - suffix;
+	std::size_t c_end = c.size() - suffix;
+	std::vector<node const *> ops;
+	std::size_t i = prefix;
+	for (; i < a_end && i < c_end; ++i) {
+		if (!equal(a[i], c[i])) {
+			ops.push_back(b.create_seq({b.create_int(std::uintmax_t(i)), diff(a[i], c[i], b, depth + 1)}));
+		}
+	}
+	if (i < a_end || i < c_end) {
+		std::vector<node const *> inserted;
+		for (std::size_t j = i; j < c_end; ++j) inserted.push_back(b.create_encoded(c[j].encoded()));
+		ops.push_back(b.create_seq({
+			b.create_int(std::uintmax_t(i)),
+			b.create_int(std::uintmax_t(a_end - i)),
+			b.create_seq(inserted)
+		}));
+	}
+	if (ops.empty()) return unchanged(b);
+	return b.create_map({{b.create_str("s"), b.create_seq(ops)}});
+}
+
+inline node const *diff(argdata_view from, argdata_view to, argdata_builder &b, std::size_t depth) {
+	if (equal(from, to)) return unchanged(b);
+	node const *patch = nullptr;
+	if (depth < max_depth) {
+		if (auto m = from.get_map()) {
+			if (auto n = to.get_map()) patch = diff_map(*m, *n, b, depth);
+		} else if (auto s = from.get_seq()) {
+			if (auto t = to.get_seq()) patch = diff_seq(*s, *t, b, depth);
+		}
+	}
+	node const *r = replace(to, b);
+	return patch && patch->encoded_size() < r->encoded_size() ? patch : r;
+}
+
+// The parts of a patch.
+struct patch_fields {
+	optional<argdata_view> replace;
+	optional<argdata_view> changed;
+	optional<argdata_view> deleted;
+	optional<argdata_view> splices;
+};
+
+inline optional<patch_fields> parse(argdata_view patch) {
+	auto map = patch.get_map();
+	if (!map) return {};
+	patch_fields f;
+	for (auto const &kv : *map) {
+		auto k = kv.first.get_str();
+		if (!k || k->size() != 1) return {};
+		switch ((*k)[0]) {
+			case '=': f.replace = kv.second; break;
+			case 'm': f.changed = kv.second; break;
+			case 'd': f.deleted = kv.second; break;
+			case 's': f.splices = kv.second; break;
+			default: return {};
+		}
+	}
+	return f;
+}
+
+// Applies a patch on any kind of tree. Tree gives access to the old value of
+// type Tree::value, and creates the new value of type Tree::result.
+template<typename Tree>
+optional<typename Tree::result> apply(
+	Tree &t, typename Tree::value const &old, argdata_view patch, std::size_t depth = 0
+) {
+	using result = typename Tree::result;
+	if (depth >= max_depth) return {};
+	auto f = parse(patch);
+	if (!f) return {};
+	if (f->replace) return t.create(*f->replace);
+	if (f->changed || f->deleted) {
+		auto changed = f->changed.value_or(argdata_view()).get_map();
+		auto deleted = f->deleted.value_or(argdata_view()).get_seq();
+		if ((f->changed && !changed) || (f->deleted && !deleted) || !t.is_map(old)) return {};
+		std::vector<entry> changes = changed ? sorted_entries(*changed) : std::vector<entry>();
+		std::vector<argdata_view> deletes = deleted ? elements(*deleted) : std::vector<argdata_view>();
+		std::sort(deletes.begin(), deletes.end(), less);
+		// Changes that have been applied to an existing key.
+		std::vector<bool> done(changes.size());
+		std::vector<bool> seen_deleted(deletes.size());
+		std::vector<result> keys, values;
+		bool ok = true;
+		t.for_each_entry(old, [&](typename Tree::value const &k, typename Tree::value const &v) {
+			if (!ok) return;
+			argdata_view key = t.key(k);
+			auto d = std::lower_bound(deletes.begin(), deletes.end(), key, less);
+			if (d != deletes.end() && equal(*d, key) && !seen_deleted[d - deletes.begin()]) {
+				seen_deleted[d - deletes.begin()] = true;
+				return;
+			}
+			auto c = std::lower_bound(changes.begin(), changes.end(), key,
+				[](entry const &e, argdata_view k) { return less(e.key, k); });
+			if (c != changes.end() && equal(c->key, key) && !done[c - changes.begin()]) {
+				done[c - changes.begin()] = true;
+				auto r = apply(t, v, c->value, depth + 1);
+				if (!r) { ok = false; return; }
+				keys.push_back(t.keep(k));
+				values.push_back(*r);
+			} else {
+				keys.push_back(t.keep(k));
+				values.push_back(t.keep(v));
+			}
+		});
+		if (!ok) return {};
+		// Keys that didn't exist yet, in the order of the patch.
+		if (changed) {
+			for (auto const &kv : *changed) {
+				auto c = std::lower_bound(changes.begin(), changes.end(), kv.first,
+					[](entry const &e, argdata_view k) { return less(e.key, k); });
+				if (!equal(c->key, kv.first) || done[c - changes.begin()]) continue;
+				done[c - changes.begin()] = true;
+				auto r = apply(t, t.null(), kv.second, depth + 1);
+				if (!r) return {};
+				keys.push_back(t.create(kv.first));
+				values.push_back(*r);
+			}
+		}
+		return t.create_map(keys, values);
+	}
+	if (f->splices) {
+		auto ops = f->splices->get_seq();
+		if (!ops || !t.is_seq(old)) return {};
+		std::vector<typename Tree::value> a;
+		t.for_each_element(old, [&](typename Tree::value const &v) { a.push_back(v); });
+		std::vector<result> values;
+		std::size_t pos = 0;
+		for (argdata_view op : *ops) {
+			auto args = elements(op.as_seq());
+			auto i = args.size() > 0 ? args[0].get_uint() : optional<std::uintmax_t>();
+			if (!i || *i < pos || *i > a.size()) return {};
+			for (; pos < *i; ++pos) values.push_back(t.keep(a[pos]));
+			if (args.size() == 2) {
+				if (pos == a.size()) return {};
+				auto r = apply(t, a[pos], args[1], depth + 1);
+				if (!r) return {};
+				values.push_back(*r);
+				++pos;
+			} else if (args.size() == 3) {
+				auto n = args[1].get_uint();
+				auto inserted = args[2].get_seq();
+				if (!n || !inserted || *n > a.size() - pos) return {};
+				pos += *n;
+				for (argdata_view v : *inserted) values.push_back(t.create(v));
+			} else {
+				return {};
+			}
+		}
+		for (; pos < a.size(); ++pos) values.push_back(t.keep(a[pos]));
+		return t.create_seq(values);
+	}
+	return t.keep(old);
+}
+
+// Applies a patch to an encoded value, building the result in an
+// argdata_builder.
+struct builder_tree {
+	using value = argdata_view;
+	using result = argdata_builder::node const *;
+
+	argdata_builder &b;
+
+	value null() const { return {}; }
+	bool is_map(value v) const { return bool(v.get_map()); }
+	bool is_seq(value v) const { return bool(v.get_seq()); }
+	argdata_view key(value k) const { return k; }
+	result keep(value v) const { return b.create_encoded(v.encoded()); }
+	result create(argdata_view v) const { return b.create_encoded(v.encoded()); }
+	result create_map(std::vector<result> const &keys, std::vector<result> const &values) const {
+		return b.create_map(keys, values);
+	}
+	result create_seq(std::vector<result> const &values) const { return b.create_seq(values); }
+
+	template<typename F>
+	void for_each_entry(value v, F f) const {
+		for (auto const &kv : v.as_map()) f(kv.first, kv.second);
+	}
+	template<typename F>
+	void for_each_element(value v, F f) const {
+		for (argdata_view e : v.as_seq()) f(e);
+	}
+};
+
+// Applies a patch to a persistent tree, sharing the unchanged subtrees.
+struct persistent_tree {
+	using value = argdata_persistent;
+	using result = argdata_persistent;
+
+	range<int const> fds;
+	// Encoded keys that aren't scalars, kept alive while comparing them.
+	std::vector<std::vector<unsigned char>> encoded_keys;
+
+	value null() const { return {}; }
+	bool is_map(value const &v) const { return v.is_map(); }
+	bool is_seq(value const &v) const { return v.is_seq(); }
+	argdata_view key(value const &k) {
+		if (auto s = k.get_scalar()) return *s;
+		encoded_keys.push_back(k.encode());
+		return argdata_view(encoded_keys.back());
+	}
+	result keep(value const &v) const { return v; }
+	result create(argdata_view v) const { return argdata_persistent::create(v, fds); }
+	result create_map(std::vector<result> const &keys, std::vector<result> const &values) const {
+		return argdata_persistent::create_map(keys, values);
+	}
+	result create_seq(std::vector<result> const &values) const {
+		return argdata_persistent::create_seq(values);
+	}
+
+	template<typename F>
+	void for_each_entry(value const &v, F f) const {
+		auto c = v.children();
+		for (std::size_t i = 0; i + 1 < c.size(); i += 2) f(c[i], c[i + 1]);
+	}
+	template<typename F>
+	void for_each_element(value const &v, F f) const {
+		for (argdata_persistent const &e : v.children()) f(e);
+	}
+};
+
+}
+
+// Returns the patch that turns from into to, built in b.
+inline argdata_builder::node const *argdata_diff(
+	argdata_view from, argdata_view to, argdata_builder &b
+) {
+	return argdata_diff_detail::diff(from, to, b, 0);
+}
+
+inline argdata_builder::node const *argdata_diff(
+	argdata_t const *from, argdata_t const *to, argdata_builder &b
+) {
+	std::vector<unsigned char> a = from->encode();
+	std::vector<unsigned char> c = to->encode();
+	return argdata_diff(argdata_view(a), argdata_view(c), b);
+}
+
+// Applies a patch to an encoded value, building the new value in b. Returns
+// nullptr if the patch is malformed or doesn't fit the value.
+inline argdata_builder::node const *argdata_patch(
+	argdata_view value, argdata_view patch, argdata_builder &b
+) {
+	argdata_diff_detail::builder_tree t{b};
+	return argdata_diff_detail::apply(t, value, patch).value_or(nullptr);
+}
+
+// Applies a patch to a persistent tree. Only the maps and sequences that
+// contain a change are copied. File descriptors in the patch are taken from
+// fds by their index.
+inline optional<argdata_persistent> argdata_patch(
+	argdata_persistent const &value, argdata_view patch, range<int const> fds = {}
+) {
+	argdata_diff_detail::persistent_tree t{fds, {}};
+	return argdata_diff_detail::apply(t, value, patch);
+}
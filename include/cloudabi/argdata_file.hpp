@@ -0,0 +1,89 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+
+#include <mstd/range.hpp>
+#include <mstd/string_view.hpp>
+
+#include "argdata.hpp"
+#include "argdata_view.hpp"
+#include "error_or.hpp"
+#include "fd.hpp"
+#include "fd_impl.hpp"
+#include "mem.hpp"
+#include "types.hpp"
+
+// An argdata document stored in a file, mapped into memory instead of read.
+//
+// The root value decodes directly from the mapping, so opening a file only
+// costs the pages that are actually touched. The mapping is read-only and
+// private, and is unmapped when the argdata_file is destroyed, which
+// invalidates the root value and anything obtained from it. File descriptor
+// values in the document have no accompanying fd list.
+class argdata_file {
+
+public:
+	argdata_file() {}
+
+	argdata_file(argdata_file &&other) { swap(other); }
+
+	argdata_file &operator=(argdata_file &&other) {
+		argdata_file(std::move(other)).swap(*this);
+		return *this;
+	}
+
+	~argdata_file() {
+		root_.reset();
+		if (data_.size() > 0) cloudabi::mem_unmap(data_);
+	}
+
+	void swap(argdata_file &other) {
+		std::swap(data_, other.data_);
+		std::swap(root_, other.root_);
+	}
+
+	// Opens and maps the file at path, relative to dir. With willneed, the
+	// kernel is advised to read the whole file ahead.
+	static cloudabi::error_or<argdata_file> open(
+		cloudabi::fd dir, string_view path, bool willneed = false
+	) {
+		// Mapping for reading also needs the right to read.
+		auto file = dir.file_open(path,
+			cloudabi::rights::fd_read | cloudabi::rights::mem_map | cloudabi::rights::file_stat_fget);
+		if (!file) return file.error();
+		return map(file->get(), willneed);
+	}
+
+	// Maps an open file. The file descriptor is not needed afterwards.
+	static cloudabi::error_or<argdata_file> map(cloudabi::fd file, bool willneed = false) {
+		auto stat = file.file_stat_fget();
+		if (!stat) return stat.error();
+		argdata_file f;
+		if (stat->st_size > 0) {
+			if (stat->st_size > SIZE_MAX) return cloudabi::error::fbig;
+			std::size_t size = std::size_t(stat->st_size);
+			auto mem = file.mem_map(size);
+			if (!mem) return mem.error();
+			f.data_ = range<unsigned char>(static_cast<unsigned char *>(*mem), size);
+			// Only a hint, so failure is ignored.
+			if (willneed) cloudabi::mem_advise(f.data_, cloudabi::advice::willneed);
+		}
+		f.root_ = argdata_t::create_encoded(f.data_);
+		return f;
+	}
+
+	argdata_t const *get() const { return root_.get(); }
+	argdata_t const &operator*() const { return *root_; }
+	argdata_t const *operator->() const { return root_.get(); }
+
+	range<unsigned char const> encoded() const { return data_; }
+
+	// The root value, without going through the argdata library.
+	argdata_view view() const { return argdata_view(data_); }
+
+private:
+	range<unsigned char> data_;
+	std::unique_ptr<argdata_t> root_;
+
+};
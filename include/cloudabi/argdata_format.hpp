@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Low level helpers for the serialized argdata format, as produced by
+// argdata_get_buffer() and accepted by argdata_create_buffer().
+//
+// Every value starts with a one byte type tag, followed by its contents.
+// The contents of maps and sequences are a list of subfields, which are
+// encoded values prefixed by their length. An empty value is null.
+namespace argdata_format {
+
+using std::size_t;
+
+enum class tag : unsigned char {
+	binary    = 1,
+	bool_     = 2,
+	fd        = 3,
+	float_    = 4,
+	int_      = 5,
+	map       = 6,
+	seq       = 7,
+	str       = 8,
+	timestamp = 9,
+};
+
+// Subfield lengths are big endian base-128 numbers, with the highest bit
+// set only on the last byte.
+
+inline size_t subfield_length_size(size_t len) {
+	size_t n = 1;
+	while (n < (sizeof(size_t) * 8 + 6) / 7 && len >> (7 * n) != 0) ++n;
+	return n;
+}
+
+inline unsigned char *write_subfield_length(unsigned char *out, size_t len) {
+	size_t n = subfield_length_size(len);
+	while (n-- > 1) *out++ = (len >> (7 * n)) & 0x7f;
+	*out++ = (len & 0x7f) | 0x80;
+	return out;
+}
+
+// Reads a subfield length at pos, advancing pos past it. Returns false if the
+// length is malformed, or if the subfield does not fit before end.
+inline bool read_subfield_length(unsigned char const *&pos, unsigned char const *end, size_t &len) {
+	len = 0;
+	unsigned char byte;
+	do {
+		if (pos == end || len > (size_t(-1) >> 7)) return false;
+		byte = *pos++;
+		len = len << 7 | (byte & 0x7f);
+	} while (!(byte & 0x80));
+	return len <= size_t(end - pos);
+}
+
+// Integers are big endian two's complement numbers, using as few bytes as
+// possible. Zero is encoded without any bytes.
+
+inline size_t int_size(std::intmax_t v) {
+	if (v == 0) return 0;
+	size_t n = 1;
+	while (n < sizeof(v) && (
+		v < -(std::intmax_t(1) << (8 * n - 1)) ||
+		v >= (std::intmax_t(1) << (8 * n - 1))
+	)) ++n;
+	return n;
+}
+
+inline size_t uint_size(std::uintmax_t v) {
+	if (std::intmax_t(v) >= 0) return int_size(std::intmax_t(v));
+	return sizeof(v) + 1;
+}
+
+inline unsigned char *write_int(unsigned char *out, std::uintmax_t v, size_t n) {
+	while (n-- > 0) *out++ = n < sizeof(v) ? (v >> (8 * n)) & 0xff : 0;
+	return out;
+}
+
+// Reads n bytes as a sign extended integer. Callers check that n is in range.
+inline std::uintmax_t read_int(unsigned char const *in, size_t n) {
+	std::uintmax_t v = n > 0 && (in[0] & 0x80) ? ~std::uintmax_t(0) : 0;
+	while (n-- > 0) v = v << 8 | *in++;
+	return v;
+}
+
+// Floats are big endian IEEE 754 doubles.
+
+inline unsigned char *write_float(unsigned char *out, double v) {
+	std::uint64_t bits;
+	std::memcpy(&bits, &v, sizeof(bits));
+	return write_int(out, bits, sizeof(bits));
+}
+
+inline double read_float(unsigned char const *in) {
+	std::uint64_t bits = read_int(in, sizeof(bits));
+	double v;
+	std::memcpy(&v, &bits, sizeof(v));
+	return v;
+}
+
+// File descriptors are encoded as a 32-bit big endian index into the list of
+// file descriptors that is transferred alongside the data.
+
+inline unsigned char *write_fd(unsigned char *out, std::uint32_t index) {
+	return write_int(out, index, sizeof(index));
+}
+
+inline std::uint32_t read_fd(unsigned char const *in) {
+	return std::uint32_t(read_int(in, sizeof(std::uint32_t)));
+}
+
+}
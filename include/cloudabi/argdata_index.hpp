@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include <mstd/optional.hpp>
+#include <mstd/range.hpp>
+#include <mstd/string_view.hpp>
+
+#include "argdata_format.hpp"
+#include "argdata_view.hpp"
+
+// Random access into an encoded argdata sequence.
+//
+// Elements of a sequence are prefixed by their length, so finding the nth
+// element means decoding the lengths of all elements before it. An index
+// decodes them all once, after which any element is found in O(1). Elements
+// are returned as views into the original buffer, which must outlive the
+// index.
+class argdata_seq_index {
+
+private:
+	// Offsets of the first and past-the-end byte of an element, relative to
+	// the start of the sequence. Sequences over 4 GiB can't be indexed.
+	struct element {
+		std::uint32_t begin;
+		std::uint32_t end;
+	};
+
+	unsigned char const *base_ = nullptr;
+	std::vector<element> elements_;
+
+public:
+	class iterator;
+
+	argdata_seq_index() {}
+
+	// Returns nullopt if seq is not a well-formed sequence.
+	static optional<argdata_seq_index> create(argdata_view seq) {
+		auto contents = seq.get_seq_contents();
+		if (!contents || seq.encoded().size() > UINT32_MAX) return {};
+		argdata_seq_index index;
+		index.base_ = seq.encoded().data();
+		unsigned char const *pos = contents->data();
+		unsigned char const *end = pos + contents->size();
+		while (pos != end) {
+			std::size_t len;
+			if (!argdata_format::read_subfield_length(pos, end, len)) return {};
+			std::uint32_t begin = std::uint32_t(pos - index.base_);
+			index.elements_.push_back({begin, std::uint32_t(begin + len)});
+			pos += len;
+		}
+		return index;
+	}
+
+	std::size_t size() const { return elements_.size(); }
+
+	bool empty() const { return elements_.empty(); }
+
+	argdata_view operator[](std::size_t i) const {
+		element e = elements_[i];
+		return argdata_view(range<unsigned char const>(base_ + e.begin, base_ + e.end));
+	}
+
+	iterator begin() const;
+	iterator end() const;
+
+};
+
+class argdata_seq_index::iterator {
+public:
+	using value_type = argdata_view;
+	using difference_type = std::ptrdiff_t;
+	using pointer = void;
+	using reference = argdata_view;
+	using iterator_category = std::random_access_iterator_tag;
+private:
+	argdata_seq_index const *index_ = nullptr;
+	std::size_t i_ = 0;
+	friend argdata_seq_index;
+	iterator(argdata_seq_index const *index, std::size_t i) : index_(index), i_(i) {}
+public:
+	iterator() {}
+	reference operator*() const { return (*index_)[i_]; }
+	reference operator[](difference_type n) const { return (*index_)[i_ + n]; }
+	iterator &operator++() { ++i_; return *this; }
+	iterator &operator--() { --i_; return *this; }
+	iterator operator++(int) { iterator copy = *this; ++i_; return copy; }
+	iterator operator--(int) { iterator copy = *this; --i_; return copy; }
+	iterator &operator+=(difference_type n) { i_ += n; return *this; }
+	iterator &operator-=(difference_type n) { i_ -= n; return *this; }
+	friend iterator operator+(iterator a, difference_type n) { return a += n; }
+	friend iterator operator+(difference_type n, iterator a) { return a += n; }
+	friend iterator operator-(iterator a, difference_type n) { return a -= n; }
+	friend difference_type operator-(iterator const &a, iterator const &b) {
+		return difference_type(a.i_) - difference_type(b.i_);
+	}
+	friend bool operator==(iterator const &a, iterator const &b) { return a.i_ == b.i_; }
+	friend bool operator!=(iterator const &a, iterator const &b) { return a.i_ != b.i_; }
+	friend bool operator< (iterator const &a, iterator const &b) { return a.i_ <  b.i_; }
+	friend bool operator> (iterator const &a, iterator const &b) { return a.i_ >  b.i_; }
+	friend bool operator<=(iterator const &a, iterator const &b) { return a.i_ <= b.i_; }
+	friend bool operator>=(iterator const &a, iterator const &b) { return a.i_ >= b.i_; }
+};
+
+inline argdata_seq_index::iterator argdata_seq_index::begin() const { return {this, 0}; }
+inline argdata_seq_index::iterator argdata_seq_index::end() const { return {this, size()}; }
+
+// Key lookup in an encoded argdata map.
+//
+// Finding a key by iterating over a map compares every key along the way. An
+// index hashes all string keys once into an open addressing table, after
+// which a lookup usually compares only a single key. If a key occurs more
+// than once, the first one is found, just like when iterating. Keys that are
+// not strings are ignored. The buffer must outlive the index.
+class argdata_map_index {
+
+private:
+	// Offsets are relative to the start of the map. Maps over 4 GiB can't be
+	// indexed.
+	struct entry {
+		std::uint32_t hash;
+		std::uint32_t key_begin;
+		std::uint32_t key_size;
+		std::uint32_t value_begin;
+		std::uint32_t value_end;
+	};
+
+	unsigned char const *base_ = nullptr;
+	std::vector<entry> entries_;
+
+	// Index in entries_ plus one, or zero for an empty slot. The number of
+	// slots is a power of two, at least twice the number of entries.
+	std::vector<std::uint32_t> slots_;
+
+	std::size_t size_ = 0;
+
+	string_view key(entry const &e) const {
+		return string_view(reinterpret_cast<char const *>(base_ + e.key_begin), e.key_size);
+	}
+
+	argdata_view value(entry const &e) const {
+		return argdata_view(range<unsigned char const>(base_ + e.value_begin, base_ + e.value_end));
+	}
+
+public:
+	argdata_map_index() {}
+
+	// FNV-1a, with a seed mixed into the initial state.
+	static std::uint64_t hash(string_view key, std::uint64_t seed = 0) {
+		std::uint64_t h = 0xcbf29ce484222325 ^ (seed * 0x9e3779b97f4a7c15);
+		for (char c : key) h = (h ^ (unsigned char)c) * 0x100000001b3;
+		return h ^ (h >> 32);
+	}
+
+	// Returns nullopt if map is not a well-formed map.
+	static optional<argdata_map_index> create(argdata_view map) {
+		auto contents = map.get_map_contents();
+		if (!contents || map.encoded().size() > UINT32_MAX) return {};
+		argdata_map_index index;
+		index.base_ = map.encoded().data();
+		unsigned char const *pos = contents->data();
+		unsigned char const *end = pos + contents->size();
+		while (pos != end) {
+			std::size_t key_len, value_len;
+			if (!argdata_format::read_subfield_length(pos, end, key_len)) return {};
+			auto key = argdata_view(range<unsigned char const>(pos, key_len)).get_str();
+			pos += key_len;
+			if (!argdata_format::read_subfield_length(pos, end, value_len)) return {};
+			if (key) {
+				index.entries_.push_back({
+					std::uint32_t(hash(*key)),
+					std::uint32_t(reinterpret_cast<unsigned char const *>(key->data()) - index.base_),
+					std::uint32_t(key->size()),
+					std::uint32_t(pos - index.base_),
+					std::uint32_t(pos + value_len - index.base_)
+				});
+			}
+			pos += value_len;
+		}
+		std::size_t n_slots = 8;
+		while (n_slots < 2 * index.entries_.size()) n_slots *= 2;
+		index.slots_.resize(n_slots);
+		for (std::size_t i = 0; i < index.entries_.size(); ++i) {
+			entry const &e = index.entries_[i];
+			std::size_t s = e.hash & (n_slots - 1);
+			while (index.slots_[s] != 0) {
+				entry const &other = index.entries_[index.slots_[s] - 1];
+				if (other.hash == e.hash && index.key(other) == index.key(e)) break;
+				s = (s + 1) & (n_slots - 1);
+			}
+			if (index.slots_[s] == 0) {
+				index.slots_[s] = std::uint32_t(i + 1);
+				++index.size_;
+			}
+		}
+		return index;
+	}
+
+	// The number of distinct string keys.
+	std::size_t size() const { return size_; }
+
+	optional<argdata_view> find(string_view k) const {
+		if (slots_.empty()) return {};
+		std::uint32_t h = std::uint32_t(hash(k));
+		std::size_t mask = slots_.size() - 1;
+		for (std::size_t s = h & mask; slots_[s] != 0; s = (s + 1) & mask) {
+			entry const &e = entries_[slots_[s] - 1];
+			if (e.hash == h && key(e) == k) return value(e);
+		}
+		return {};
+	}
+
+};
+
+// A set of keys that is fixed in advance, such as the fields of a message,
+// with a perfect hash table: every key has its own slot, so a lookup hashes
+// once and compares at most one key. Searching for the hash seed is done in
+// the constructor, so sets are best kept in a static variable. The keys must
+// outlive the set.
+template<std::size_t N>
+class argdata_key_set {
+
+	static_assert(N > 0 && N < 0xffff, "");
+
+private:
+	std::array<string_view, N> keys_;
+	std::uint64_t seed_ = 0;
+
+	// Index in keys_ plus one, or zero for an empty slot.
+	std::vector<std::uint16_t> slots_;
+
+	std::size_t slot(string_view key) const {
+		return argdata_map_index::hash(key, seed_) & (slots_.size() - 1);
+	}
+
+	bool try_seed() {
+		std::fill(slots_.begin(), slots_.end(), 0);
+		for (std::size_t i = 0; i < N; ++i) {
+			std::uint16_t &s = slots_[slot(keys_[i])];
+			if (s != 0 && keys_[s - 1] != keys_[i]) return false;
+			if (s == 0) s = std::uint16_t(i + 1);
+		}
+		return true;
+	}
+
+public:
+	explicit argdata_key_set(string_view const (&keys)[N]) {
+		std::copy(std::begin(keys), std::end(keys), keys_.begin());
+		// Try a handful of seeds, and grow the table if none of them is free
+		// of collisions.
+		std::size_t n_slots = 8;
+		while (n_slots < 4 * N) n_slots *= 2;
+		for (;; n_slots *= 2) {
+			slots_.resize(n_slots);
+			for (seed_ = 0; seed_ < 64; ++seed_) {
+				if (try_seed()) return;
+			}
+		}
+	}
+
+	std::size_t size() const { return N; }
+
+	string_view operator[](std::size_t i) const { return keys_[i]; }
+
+	// Returns the position of key in the set, or size() if it isn't in it.
+	std::size_t lookup(string_view key) const {
+		std::uint16_t s = slots_[slot(key)];
+		return s != 0 && keys_[s - 1] == key ? s - 1 : N;
+	}
+
+	// Looks up all keys in a single pass over an encoded map. Returns, for
+	// every key in the set, its first value in the map, or nullopt if it
+	// does not occur. Returns nullopt if map is not a well-formed map.
+	optional<std::array<optional<argdata_view>, N>> find_all(argdata_view map) const {
+		auto contents = map.get_map_contents();
+		if (!contents) return {};
+		std::array<optional<argdata_view>, N> values;
+		unsigned char const *pos = contents->data();
+		unsigned char const *end = pos + contents->size();
+		while (pos != end) {
+			std::size_t key_len, value_len;
+			if (!argdata_format::read_subfield_length(pos, end, key_len)) return {};
+			auto key = argdata_view(range<unsigned char const>(pos, key_len)).get_str();
+			pos += key_len;
+			if (!argdata_format::read_subfield_length(pos, end, value_len)) return {};
+			if (key) {
+				std::size_t i = lookup(*key);
+				if (i != N && !values[i]) {
+					values[i] = argdata_view(range<unsigned char const>(pos, value_len));
+				}
+			}
+			pos += value_len;
+		}
+		return values;
+	}
+
+};
@@ -0,0 +1,551 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <mstd/optional.hpp>
+#include <mstd/range.hpp>
+#include <mstd/string_view.hpp>
+
+#include "argdata.hpp"
+#include "argdata_format.hpp"
+#include "argdata_view.hpp"
+
+// An immutable argdata value, whose subtrees are shared between versions.
+//
+// Updating a value doesn't modify it, but returns a new value that only
+// copies the maps and sequences on the path to the change. All other subtrees
+// are shared with the original, so a small change to a large tree is cheap,
+// and older versions stay valid for as long as anyone refers to them. Values
+// are reference counted and can be used from any number of threads.
+//
+// Scalars are stored in their encoded form, so they are accessed through
+// argdata_view. Like argdata_builder nodes, every node knows the encoded
+// length of its subtree.
+class argdata_persistent {
+
+private:
+	enum class kind : unsigned char { scalar, fd, map, seq };
+
+	struct node {
+		kind kind_;
+		int fd_ = -1;
+		// The encoded value, for scalars.
+		std::vector<unsigned char> encoded_;
+		// Maps store their keys and values interleaved.
+		std::vector<argdata_persistent> children_;
+		std::size_t length_ = 0;
+		std::size_t n_fds_ = 0;
+
+		explicit node(kind k) : kind_(k) {}
+
+		void compute_length() {
+			n_fds_ = 0;
+			switch (kind_) {
+				case kind::scalar: length_ = encoded_.size(); break;
+				case kind::fd:     length_ = 5; n_fds_ = 1; break;
+				case kind::map:
+				case kind::seq:
+					length_ = 1;
+					for (argdata_persistent const &c : children_) {
+						std::size_t len = c.encoded_size();
+						length_ += argdata_format::subfield_length_size(len) + len;
+						n_fds_ += c.node_ ? c.node_->n_fds_ : 0;
+					}
+					break;
+			}
+		}
+	};
+
+	// Null if the value is null.
+	std::shared_ptr<node const> node_;
+
+	explicit argdata_persistent(std::shared_ptr<node const> n) : node_(std::move(n)) {}
+
+	static argdata_persistent make(kind k, std::vector<argdata_persistent> children) {
+		auto n = std::make_shared<node>(k);
+		n->children_ = std::move(children);
+		n->compute_length();
+		return argdata_persistent(std::move(n));
+	}
+
+	static argdata_persistent make_scalar(std::vector<unsigned char> encoded) {
+		auto n = std::make_shared<node>(kind::scalar);
+		n->encoded_ = std::move(encoded);
+		n->compute_length();
+		return argdata_persistent(std::move(n));
+	}
+
+	static argdata_persistent make_int(std::uintmax_t v, std::size_t size) {
+		std::vector<unsigned char> e(1 + size);
+		e[0] = (unsigned char)argdata_format::tag::int_;
+		argdata_format::write_int(e.data() + 1, v, size);
+		return make_scalar(std::move(e));
+	}
+
+	argdata_view scalar_view() const {
+		if (!node_ || node_->kind_ != kind::scalar) return {};
+		return argdata_view(node_->encoded_);
+	}
+
+	// Returns the position of the value belonging to key, or the number of
+	// children if this map doesn't contain it.
+	std::size_t find(string_view key) const {
+		auto const &c = node_->children_;
+		for (std::size_t i = 0; i < c.size(); i += 2) {
+			auto k = c[i].get_str();
+			if (k && *k == key) return i + 1;
+		}
+		return c.size();
+	}
+
+	unsigned char *write(unsigned char *out, std::vector<int> &fds) const {
+		if (!node_) return out;
+		switch (node_->kind_) {
+			case kind::scalar:
+				std::memcpy(out, node_->encoded_.data(), node_->encoded_.size());
+				return out + node_->encoded_.size();
+			case kind::fd: {
+				*out++ = (unsigned char)argdata_format::tag::fd;
+				auto i = std::find(fds.begin(), fds.end(), node_->fd_);
+				if (i == fds.end()) i = fds.insert(i, node_->fd_);
+				return argdata_format::write_fd(out, std::uint32_t(i - fds.begin()));
+			}
+			case kind::map:
+			case kind::seq:
+				*out++ = (unsigned char)(node_->kind_ == kind::map
+					? argdata_format::tag::map : argdata_format::tag::seq);
+				for (argdata_persistent const &c : node_->children_) {
+					out = argdata_format::write_subfield_length(out, c.encoded_size());
+					out = c.write(out, fds);
+				}
+				return out;
+		}
+		return out;
+	}
+
+public:
+	// A default constructed value is null.
+	argdata_persistent() {}
+
+	static argdata_persistent create_binary(range<unsigned char const> r) {
+		std::vector<unsigned char> e(1 + r.size());
+		e[0] = (unsigned char)argdata_format::tag::binary;
+		std::copy(r.begin(), r.end(), e.begin() + 1);
+		return make_scalar(std::move(e));
+	}
+	static argdata_persistent create_bool(bool v) {
+		std::vector<unsigned char> e{(unsigned char)argdata_format::tag::bool_};
+		if (v) e.push_back(1);
+		return make_scalar(std::move(e));
+	}
+	static argdata_persistent create_fd(int v) {
+		auto n = std::make_shared<node>(kind::fd);
+		n->fd_ = v;
+		n->compute_length();
+		return argdata_persistent(std::move(n));
+	}
+	static argdata_persistent create_float(double v) {
+		std::vector<unsigned char> e(9);
+		e[0] = (unsigned char)argdata_format::tag::float_;
+		argdata_format::write_float(e.data() + 1, v);
+		return make_scalar(std::move(e));
+	}
+	static argdata_persistent create_int(std::uintmax_t v) {
+		return make_int(v, argdata_format::uint_size(v));
+	}
+	static argdata_persistent create_int(std::intmax_t v) {
+		return make_int(std::uintmax_t(v), argdata_format::int_size(v));
+	}
+	static argdata_persistent create_int(int v) { return create_int(std::intmax_t(v)); }
+	static argdata_persistent create_str(string_view v) {
+		std::vector<unsigned char> e(2 + v.size());
+		e[0] = (unsigned char)argdata_format::tag::str;
+		std::memcpy(e.data() + 1, v.data(), v.size());
+		e.back() = '\0';
+		return make_scalar(std::move(e));
+	}
+
+	static argdata_persistent create_map(
+		range<argdata_persistent const> keys,
+		range<argdata_persistent const> values
+	) {
+		std::size_t size = keys.size() < values.size() ? keys.size() : values.size();
+		std::vector<argdata_persistent> children;
+		children.reserve(2 * size);
+		for (std::size_t i = 0; i < size; ++i) {
+			children.push_back(keys[i]);
+			children.push_back(values[i]);
+		}
+		return make(kind::map, std::move(children));
+	}
+	static argdata_persistent create_map() {
+		return make(kind::map, {});
+	}
+
+	static argdata_persistent create_seq(range<argdata_persistent const> values) {
+		return make(kind::seq, std::vector<argdata_persistent>(values.begin(), values.end()));
+	}
+	static argdata_persistent create_seq() {
+		return make(kind::seq, {});
+	}
+
+	// Copies a tree of argdata_t nodes. Values of types that argdata_t has
+	// no accessors for, such as timestamps, are copied in their encoded form.
+	static argdata_persistent create(argdata_t const *value) {
+		if (auto fd = value->get_fd()) return create_fd(*fd);
+		if (auto map = value->get_map()) {
+			std::vector<argdata_persistent> children;
+			for (auto const &kv : *map) {
+				children.push_back(create(kv.first));
+				children.push_back(create(kv.second));
+			}
+			return make(kind::map, std::move(children));
+		}
+		if (auto seq = value->get_seq()) {
+			std::vector<argdata_persistent> children;
+			for (argdata_t const *v : *seq) children.push_back(create(v));
+			return make(kind::seq, std::move(children));
+		}
+		std::vector<unsigned char> e(value->encoded_size());
+		if (e.empty()) return {};
+		argdata_get_buffer(value, e.data(), nullptr);
+		return make_scalar(std::move(e));
+	}
+
+	// Copies an encoded value. File descriptors are taken from fds by their
+	// index, and become -1 if the index is out of range.
+	static argdata_persistent create(argdata_view value, range<int const> fds = {}) {
+		if (value.is_null()) return {};
+		if (auto map = value.get_map()) {
+			std::vector<argdata_persistent> children;
+			for (auto const &kv : *map) {
+				children.push_back(create(kv.first, fds));
+				children.push_back(create(kv.second, fds));
+			}
+			return make(kind::map, std::move(children));
+		}
+		if (auto seq = value.get_seq()) {
+			std::vector<argdata_persistent> children;
+			for (argdata_view v : *seq) children.push_back(create(v, fds));
+			return make(kind::seq, std::move(children));
+		}
+		if (auto fd = value.get_fd()) {
+			return create_fd(std::size_t(*fd) < fds.size() ? fds[*fd] : -1);
+		}
+		auto e = value.encoded();
+		return make_scalar(std::vector<unsigned char>(e.begin(), e.end()));
+	}
+
+	bool is_null() const { return !node_; }
+	bool is_map() const { return node_ && node_->kind_ == kind::map; }
+	bool is_seq() const { return node_ && node_->kind_ == kind::seq; }
+
+	// Whether both refer to the same node, which is how unchanged subtrees
+	// of two versions can be recognized without comparing them.
+	bool same(argdata_persistent const &other) const { return node_ == other.node_; }
+
+	optional<range<unsigned char const>> get_binary() const { return scalar_view().get_binary(); }
+	optional<bool>                       get_bool  () const { return scalar_view().get_bool  (); }
+	optional<double>                     get_float () const { return scalar_view().get_float (); }
+	optional<std::intmax_t>              get_int   () const { return scalar_view().get_int   (); }
+	optional<std::uintmax_t>             get_uint  () const { return scalar_view().get_uint  (); }
+	optional<string_view>                get_str   () const { return scalar_view().get_str   (); }
+	optional<int> get_fd() const {
+		if (!node_ || node_->kind_ != kind::fd) return {};
+		return node_->fd_;
+	}
+
+	// Same as above, but return a default value (empty/zero/etc.) instead of nullopt.
+	range<unsigned char const> as_binary() const { return get_binary().value_or(range<unsigned char const>{}); }
+	bool                       as_bool  () const { return get_bool  ().value_or(                       false); }
+	int                        as_fd    () const { return get_fd    ().value_or(                          -1); }
+	double                     as_float () const { return get_float ().value_or(                         0.0); }
+	std::intmax_t              as_int   () const { return get_int   ().value_or(                           0); }
+	std::uintmax_t             as_uint  () const { return get_uint  ().value_or(                           0); }
+	string_view                as_str   () const { return get_str   ().value_or(               string_view{}); }
+
+	// The encoded form of a value that is neither a map, a sequence nor a
+	// file descriptor.
+	optional<argdata_view> get_scalar() const {
+		if (!node_ || node_->kind_ != kind::scalar) return {};
+		return argdata_view(node_->encoded_);
+	}
+
+	// The keys and values of a map, interleaved, or the elements of a
+	// sequence. Empty for any other value.
+	range<argdata_persistent const> children() const {
+		if (!is_map() && !is_seq()) return {};
+		return {node_->children_.data(), node_->children_.size()};
+	}
+
+	// The number of entries of a map, or elements of a sequence.
+	std::size_t size() const {
+		return is_map() ? children().size() / 2 : children().size();
+	}
+
+	// The nth element of a sequence. Null if out of range.
+	argdata_persistent operator[](std::size_t i) const {
+		return is_seq() && i < size() ? node_->children_[i] : argdata_persistent();
+	}
+
+	// The value of the first entry of a map with the given string key.
+	optional<argdata_persistent> get(string_view key) const {
+		if (!is_map()) return {};
+		std::size_t i = find(key);
+		if (i == node_->children_.size()) return {};
+		return node_->children_[i];
+	}
+
+	// Returns a copy of this map with the value of key replaced, or with the
+	// entry added at the end if it doesn't exist yet. Anything that isn't a
+	// map is treated as an empty map.
+	argdata_persistent set(string_view key, argdata_persistent value) const {
+		std::vector<argdata_persistent> children;
+		if (is_map()) children = node_->children_;
+		std::size_t i = is_map() ? find(key) : 0;
+		if (i < children.size()) {
+			if (children[i].same(value)) return *this;
+			children[i] = std::move(value);
+		} else {
+			children.push_back(create_str(key));
+			children.push_back(std::move(value));
+		}
+		return make(kind::map, std::move(children));
+	}
+
+	// Returns a copy of this map without the entry for key.
+	argdata_persistent erase(string_view key) const {
+		if (!is_map()) return *this;
+		std::size_t i = find(key);
+		if (i == node_->children_.size()) return *this;
+		std::vector<argdata_persistent> children;
+		children.reserve(node_->children_.size() - 2);
+		children.insert(children.end(), node_->children_.begin(), node_->children_.begin() + (i - 1));
+		children.insert(children.end(), node_->children_.begin() + (i + 1), node_->children_.end());
+		return make(kind::map, std::move(children));
+	}
+
+	// Sets or erases a value in nested maps, following a path of keys.
+	// Maps that are missing along the path are created.
+	argdata_persistent set_in(range<string_view const> path, argdata_persistent value) const {
+		if (path.size() == 0) return value;
+		range<string_view const> rest(path.data() + 1, path.size() - 1);
+		argdata_persistent child = get(path[0]).value_or(argdata_persistent());
+		return set(path[0], child.set_in(rest, std::move(value)));
+	}
+	argdata_persistent erase_in(range<string_view const> path) const {
+		if (path.size() == 0) return {};
+		if (path.size() == 1) return erase(path[0]);
+		auto child = get(path[0]);
+		if (!child) return *this;
+		range<string_view const> rest(path.data() + 1, path.size() - 1);
+		return set(path[0], child->erase_in(rest));
+	}
+
+	// Returns a copy of this sequence with the nth element replaced. Returns
+	// the sequence unchanged if i is out of range.
+	argdata_persistent set(std::size_t i, argdata_persistent value) const {
+		if (!is_seq() || i >= size() || node_->children_[i].same(value)) return *this;
+		std::vector<argdata_persistent> children = node_->children_;
+		children[i] = std::move(value);
+		return make(kind::seq, std::move(children));
+	}
+
+	// Returns a copy of this sequence with value appended. Anything that
+	// isn't a sequence is treated as an empty sequence.
+	argdata_persistent push_back(argdata_persistent value) const {
+		std::vector<argdata_persistent> children;
+		if (is_seq()) {
+			children.reserve(node_->children_.size() + 1);
+			children = node_->children_;
+		}
+		children.push_back(std::move(value));
+		return make(kind::seq, std::move(children));
+	}
+
+	// n_fds is set to the number of file descriptor nodes, which is an upper
+	// bound on the number of file descriptors that encode() returns.
+	std::size_t encoded_size(std::size_t *n_fds = nullptr) const {
+		if (n_fds) *n_fds = node_ ? node_->n_fds_ : 0;
+		return node_ ? node_->length_ : 0;
+	}
+
+	void encode(std::vector<unsigned char> &buffer, std::vector<int> &fds) const {
+		buffer.resize(encoded_size());
+		fds.clear();
+		fds.reserve(node_ ? node_->n_fds_ : 0);
+		write(buffer.data(), fds);
+	}
+
+	std::vector<unsigned char> encode(std::vector<int> *fds = nullptr) const {
+		std::vector<unsigned char> buffer;
+		std::vector<int> unused;
+		encode(buffer, fds ? *fds : unused);
+		return buffer;
+	}
+
+};
+
+// Publishes versions of an argdata_persistent tree to any number of reading
+// threads, without readers ever taking a lock.
+//
+// Every reading thread registers once, which claims one of a fixed number of
+// reader slots. While reading, a reader announces the current epoch in its
+// slot. Publishing a new version swaps the root pointer and advances the
+// epoch. The old root is kept until every reader that announced an older
+// epoch has finished, and only then released. Publishers are serialized by a
+// mutex, which readers never touch.
+//
+// Roots that are still in use by a reader are released by a later publish()
+// or reclaim(). A reader holding on to a version for longer than a single
+// read should copy the argdata_persistent, which keeps it alive on its own.
+class argdata_rcu {
+
+private:
+	// Padded, so that readers don't share cache lines.
+	struct slot {
+		std::atomic<std::uint64_t> epoch{0};
+		std::atomic<bool> used{false};
+		unsigned char padding[64 - sizeof(std::atomic<std::uint64_t>) - sizeof(std::atomic<bool>)];
+	};
+
+	struct retired {
+		std::uint64_t epoch;
+		argdata_persistent const *root;
+	};
+
+	std::unique_ptr<slot[]> slots_;
+	std::size_t n_slots_;
+	std::atomic<argdata_persistent const *> root_;
+	std::atomic<std::uint64_t> epoch_{1};
+	std::mutex writer_;
+	std::vector<retired> retired_;
+
+	void reclaim_locked() {
+		std::uint64_t oldest = UINT64_MAX;
+		for (std::size_t i = 0; i < n_slots_; ++i) {
+			std::uint64_t e = slots_[i].epoch.load();
+			if (e != 0 && e < oldest) oldest = e;
+		}
+		// A reader that announced an epoch at least as new as the one a root
+		// was retired in can only have seen a newer root.
+		auto keep = std::partition(retired_.begin(), retired_.end(),
+			[oldest](retired const &r) { return r.epoch > oldest; });
+		for (auto i = keep; i != retired_.end(); ++i) delete i->root;
+		retired_.erase(keep, retired_.end());
+	}
+
+public:
+	class reader;
+	class read_guard;
+
+	explicit argdata_rcu(argdata_persistent root = {}, std::size_t max_readers = 64)
+		: slots_(new slot[max_readers]), n_slots_(max_readers),
+		  root_(new argdata_persistent(std::move(root))) {}
+
+	argdata_rcu(argdata_rcu const &) = delete;
+	argdata_rcu &operator=(argdata_rcu const &) = delete;
+
+	// All readers must be gone.
+	~argdata_rcu() {
+		for (retired const &r : retired_) delete r.root;
+		delete root_.load();
+	}
+
+	// Claims a reader slot. Returns nullopt if all of them are in use.
+	optional<reader> register_reader();
+
+	// Replaces the current version.
+	void publish(argdata_persistent root) {
+		auto *new_root = new argdata_persistent(std::move(root));
+		std::lock_guard<std::mutex> lock(writer_);
+		argdata_persistent const *old = root_.exchange(new_root);
+		retired_.push_back({epoch_.fetch_add(1) + 1, old});
+		reclaim_locked();
+	}
+
+	// Derives a new version from the current one, with f(current), without
+	// losing concurrent updates.
+	template<typename F>
+	void update(F f) {
+		std::lock_guard<std::mutex> lock(writer_);
+		auto *new_root = new argdata_persistent(f(*root_.load()));
+		argdata_persistent const *old = root_.exchange(new_root);
+		retired_.push_back({epoch_.fetch_add(1) + 1, old});
+		reclaim_locked();
+	}
+
+	// Releases the old versions that are no longer in use.
+	void reclaim() {
+		std::lock_guard<std::mutex> lock(writer_);
+		reclaim_locked();
+	}
+
+	// The number of old versions waiting for readers to finish.
+	std::size_t retired_count() {
+		std::lock_guard<std::mutex> lock(writer_);
+		return retired_.size();
+	}
+
+};
+
+// The current version, as seen by one reader. Guards of the same reader
+// can't be nested, and the version is only valid until the guard is
+// destroyed.
+class argdata_rcu::read_guard {
+private:
+	slot *slot_;
+	argdata_persistent const *root_;
+	friend reader;
+	read_guard(argdata_rcu &rcu, slot *s) : slot_(s) {
+		slot_->epoch.store(rcu.epoch_.load());
+		root_ = rcu.root_.load();
+	}
+public:
+	read_guard(read_guard &&other) : slot_(other.slot_), root_(other.root_) { other.slot_ = nullptr; }
+	read_guard &operator=(read_guard const &) = delete;
+	~read_guard() { if (slot_) slot_->epoch.store(0, std::memory_order_release); }
+	argdata_persistent const &operator*() const { return *root_; }
+	argdata_persistent const *operator->() const { return root_; }
+};
+
+// A registered reader, to be used by a single thread at a time.
+class argdata_rcu::reader {
+private:
+	argdata_rcu *rcu_ = nullptr;
+	slot *slot_ = nullptr;
+	friend argdata_rcu;
+	reader(argdata_rcu *rcu, slot *s) : rcu_(rcu), slot_(s) {}
+public:
+	reader(reader &&other) : rcu_(other.rcu_), slot_(other.slot_) { other.slot_ = nullptr; }
+	reader &operator=(reader &&other) {
+		std::swap(rcu_, other.rcu_);
+		std::swap(slot_, other.slot_);
+		return *this;
+	}
+	~reader() { if (slot_) slot_->used.store(false, std::memory_order_release); }
+
+	read_guard read() { return read_guard(*rcu_, slot_); }
+
+	// A copy of the current version, which stays valid on its own.
+	argdata_persistent snapshot() { return *read(); }
+};
+
+inline optional<argdata_rcu::reader> argdata_rcu::register_reader() {
+	for (std::size_t i = 0; i < n_slots_; ++i) {
+		bool expected = false;
+		if (!slots_[i].used.load(std::memory_order_relaxed) &&
+			slots_[i].used.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+			return reader(this, &slots_[i]);
+		}
+	}
+	return {};
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <mstd/optional.hpp>
+#include <mstd/range.hpp>
+
+#include "argdata_format.hpp"
+#include "argdata_view.hpp"
+
+// Decodes argdata that arrives in chunks, such as from a stream socket.
+//
+// An encoded value has no length of its own, so a top-level value is only
+// complete once the input ends. The elements of a top-level sequence are
+// length-prefixed however, so they are returned one by one as soon as they
+// are complete, and are dropped from the buffer afterwards. A long sequence
+// can thus be processed using only as much memory as its largest element.
+//
+// Read directly into the decoder with prepare() and commit(), or copy data
+// into it with feed(). Then call next() until it returns nullopt.
+class argdata_stream_decoder {
+
+public:
+	// Elements (or a top-level value that is not a sequence) of more than
+	// max_size bytes make the decoder fail.
+	explicit argdata_stream_decoder(std::size_t max_size = SIZE_MAX)
+		: max_size_(max_size) {}
+
+	// Returns space for at least n more bytes of input. Invalidates the views
+	// returned by next().
+	range<unsigned char> prepare(std::size_t n) {
+		if (buffer_.size() - end_ < n && begin_ > 0) {
+			// Drop the elements that have already been returned.
+			std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+			end_ -= begin_;
+			begin_ = 0;
+		}
+		if (buffer_.size() - end_ < n) buffer_.resize(end_ + n);
+		return {buffer_.data() + end_, buffer_.size() - end_};
+	}
+
+	// Marks n bytes of the space returned by prepare() as input.
+	void commit(std::size_t n) { end_ += n; }
+
+	void feed(range<unsigned char const> data) {
+		std::memcpy(prepare(data.size()).data(), data.data(), data.size());
+		commit(data.size());
+	}
+
+	// Returns the next complete element of the top-level sequence, or
+	// nullopt if more input is needed, the top-level value is not a
+	// sequence, or the input is malformed. The view is valid until the next
+	// call to next(), prepare() or feed().
+	optional<argdata_view> next() {
+		update_state();
+		if (state_ != state::seq) return {};
+		// Subfield lengths end at the first byte with the highest bit set.
+		std::size_t len = 0;
+		std::size_t pos = begin_;
+		for (;;) {
+			if (pos == end_) return {};
+			unsigned char byte = buffer_[pos++];
+			if (len > (max_size_ >> 7)) {
+				state_ = state::failed;
+				return {};
+			}
+			len = len << 7 | (byte & 0x7f);
+			if (byte & 0x80) break;
+		}
+		if (len > max_size_) {
+			state_ = state::failed;
+			return {};
+		}
+		if (end_ - pos < len) return {};
+		begin_ = pos + len;
+		return argdata_view(range<unsigned char const>(buffer_.data() + pos, len));
+	}
+
+	// Whether the top-level value is a sequence. Only known after the first
+	// byte of input.
+	bool is_seq() const { return state_ == state::seq; }
+
+	bool failed() const { return state_ == state::failed; }
+
+	// Call when the input has ended, after next() has returned all
+	// elements. Returns whether the input ended at the end of a value.
+	bool finish() {
+		update_state();
+		if (state_ == state::seq && begin_ != end_) state_ = state::failed;
+		return state_ != state::failed;
+	}
+
+	// The top-level value, if it is not a sequence, once finish() returned
+	// true. Empty input is null.
+	argdata_view value() const {
+		if (state_ != state::value) return {};
+		return argdata_view(range<unsigned char const>(buffer_.data() + begin_, end_ - begin_));
+	}
+
+private:
+	enum class state { start, seq, value, failed };
+
+	std::size_t max_size_;
+	state state_ = state::start;
+	std::vector<unsigned char> buffer_;
+
+	// The part of buffer_ that holds input that hasn't been returned yet.
+	std::size_t begin_ = 0;
+	std::size_t end_ = 0;
+
+	void update_state() {
+		if (state_ == state::start && begin_ != end_) {
+			if (buffer_[begin_] == (unsigned char)argdata_format::tag::seq) {
+				state_ = state::seq;
+				++begin_;
+			} else {
+				state_ = state::value;
+			}
+		}
+		if (state_ == state::value && end_ - begin_ > max_size_) state_ = state::failed;
+	}
+
+};
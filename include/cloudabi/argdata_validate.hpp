@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <mstd/range.hpp>
+
+#include "argdata_format.hpp"
+#include "argdata_view.hpp"
+
+// Up-front validation of encoded argdata received from untrusted sources.
+//
+// Once argdata_validate() accepted a buffer, the get_*() accessors of any
+// value in it only fail on a type mismatch, strings are valid UTF-8 without
+// embedded null bytes, and iterating over maps and sequences never stops
+// early.
+
+namespace argdata_validate_detail {
+
+// Returns the first byte in [p, e) that is not in the range 0x01-0x7f.
+inline unsigned char const *skip_ascii(unsigned char const *p, unsigned char const *e) {
+#if defined(__AVX2__)
+	while (e - p >= 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+		__m256i zero = _mm256_cmpeq_epi8(v, _mm256_setzero_si256());
+		unsigned mask = unsigned(_mm256_movemask_epi8(_mm256_or_si256(v, zero)));
+		if (mask) return p + __builtin_ctz(mask);
+		p += 32;
+	}
+#endif
+#if defined(__SSE2__)
+	while (e - p >= 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+		__m128i zero = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+		unsigned mask = unsigned(_mm_movemask_epi8(_mm_or_si128(v, zero)));
+		if (mask) return p + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+	while (p != e && (unsigned char)(*p - 1) < 0x7f) ++p;
+	return p;
+}
+
+}
+
+// Checks that data is valid UTF-8 without null bytes. ASCII is checked 16 or
+// 32 bytes at a time where SSE2 or AVX2 is available.
+inline bool argdata_validate_utf8(range<unsigned char const> data) {
+	unsigned char const *p = data.data();
+	unsigned char const *e = p + data.size();
+	for (;;) {
+		p = argdata_validate_detail::skip_ascii(p, e);
+		if (p == e) return true;
+		unsigned char c = *p++;
+		std::size_t n;
+		unsigned char min = 0x80, max = 0xbf;
+		if (c >= 0xc2 && c <= 0xdf) {
+			n = 1;
+		} else if (c >= 0xe0 && c <= 0xef) {
+			n = 2;
+			if (c == 0xe0) min = 0xa0; // Overlong.
+			if (c == 0xed) max = 0x9f; // Surrogates.
+		} else if (c >= 0xf0 && c <= 0xf4) {
+			n = 3;
+			if (c == 0xf0) min = 0x90; // Overlong.
+			if (c == 0xf4) max = 0x8f; // Above U+10FFFF.
+		} else {
+			// Null, a continuation byte, or an overlong or invalid lead byte.
+			return false;
+		}
+		if (std::size_t(e - p) < n || *p < min || *p > max) return false;
+		for (std::size_t i = 1; i < n; ++i) {
+			if ((p[i] & 0xc0) != 0x80) return false;
+		}
+		p += n;
+	}
+}
+
+// Checks the structure of an encoded value: type tags, subfield lengths, the
+// sizes of fixed size values, terminating null bytes and UTF-8 of strings,
+// and that file descriptor indices are below n_fds and fit in an int, as
+// they are returned as one. Nesting is handled without recursion, so deeply
+// nested input can't overflow the stack.
+inline bool argdata_validate(argdata_view value, std::size_t n_fds = SIZE_MAX) {
+	using argdata_format::tag;
+	n_fds = std::min<std::size_t>(n_fds, std::size_t(INT_MAX) + 1);
+
+	struct container {
+		unsigned char const *end;
+		bool is_map;
+		bool odd;
+	};
+	std::vector<container> stack;
+
+	// Checks the value in [p, e). Containers are pushed on the stack, and
+	// their elements are checked afterwards.
+	auto check = [&](unsigned char const *p, unsigned char const *e) -> bool {
+		if (p == e) return true;
+		unsigned char const *c = p + 1;
+		std::size_t size = std::size_t(e - c);
+		switch (tag(*p)) {
+			case tag::binary:
+				return true;
+			case tag::bool_:
+				return size == 0 || (size == 1 && *c == 1);
+			case tag::fd:
+				return size == 4 && argdata_format::read_fd(c) < n_fds;
+			case tag::float_:
+				return size == 8;
+			case tag::int_:
+				return size <= sizeof(std::uintmax_t) || (size == sizeof(std::uintmax_t) + 1 && *c == 0);
+			case tag::map:
+			case tag::seq:
+				stack.push_back({e, tag(*p) == tag::map, false});
+				return true;
+			case tag::str:
+				return size > 0 && e[-1] == '\0' &&
+					argdata_validate_utf8(range<unsigned char const>(c, size - 1));
+			case tag::timestamp:
+				return size <= 12;
+		}
+		return false;
+	};
+
+	unsigned char const *pos = value.encoded().data();
+	std::size_t size = value.encoded().size();
+	if (!check(pos, pos + size)) return false;
+	// An empty value is null, and its data may be a null pointer.
+	if (size == 0) return true;
+	++pos;
+	while (!stack.empty()) {
+		container &top = stack.back();
+		if (pos == top.end) {
+			if (top.is_map && top.odd) return false;
+			stack.pop_back();
+			continue;
+		}
+		std::size_t len;
+		if (!argdata_format::read_subfield_length(pos, top.end, len)) return false;
+		top.odd = !top.odd;
+		unsigned char const *element = pos;
+		pos += len;
+		// For containers, continue with their first element. Their end is
+		// where their parent continues.
+		std::size_t depth = stack.size();
+		if (!check(element, pos)) return false;
+		if (stack.size() > depth) pos = element + 1;
+	}
+	return true;
+}
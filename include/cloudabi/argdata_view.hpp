@@ -0,0 +1,254 @@
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+
+#include <mstd/optional.hpp>
+#include <mstd/range.hpp>
+#include <mstd/string_view.hpp>
+
+#include "argdata.hpp"
+#include "argdata_format.hpp"
+
+// A non-owning view of a single encoded argdata value, as produced by
+// argdata_t::encode() and accepted by argdata_t::create_encoded().
+//
+// Views don't allocate and are cheap to copy. They give the same accessors as
+// argdata_t, decoding directly from the buffer, which must outlive the view.
+// File descriptors are returned as their index in the accompanying fd list.
+class argdata_view {
+
+private:
+	range<unsigned char const> data_;
+
+	optional<range<unsigned char const>> contents(argdata_format::tag t) const {
+		if (data_.size() == 0 || data_.data()[0] != (unsigned char)t) return {};
+		return range<unsigned char const>{data_.data() + 1, data_.size() - 1};
+	}
+
+public:
+	// A view of an empty buffer is null.
+	argdata_view() {}
+
+	explicit argdata_view(range<unsigned char const> data) : data_(data) {}
+
+	range<unsigned char const> encoded() const { return data_; }
+
+	bool is_null() const { return data_.size() == 0; }
+
+	optional<range<unsigned char const>> get_binary() const {
+		return contents(argdata_format::tag::binary);
+	}
+	optional<bool> get_bool() const {
+		auto c = contents(argdata_format::tag::bool_);
+		if (!c) return {};
+		if (c->size() == 0) return false;
+		if (c->size() == 1 && c->data()[0] == 1) return true;
+		return {};
+	}
+	optional<int> get_fd() const {
+		auto c = contents(argdata_format::tag::fd);
+		if (!c || c->size() != 4) return {};
+		std::uint32_t index = argdata_format::read_fd(c->data());
+		if (index > INT_MAX) return {};
+		return int(index);
+	}
+	optional<double> get_float() const {
+		auto c = contents(argdata_format::tag::float_);
+		if (!c || c->size() != 8) return {};
+		return argdata_format::read_float(c->data());
+	}
+	optional<std::intmax_t> get_int() const {
+		auto c = contents(argdata_format::tag::int_);
+		if (!c || c->size() > sizeof(std::intmax_t)) return {};
+		return std::intmax_t(argdata_format::read_int(c->data(), c->size()));
+	}
+	optional<std::uintmax_t> get_uint() const {
+		auto c = contents(argdata_format::tag::int_);
+		if (!c || c->size() > sizeof(std::uintmax_t) + 1) return {};
+		if (c->size() > 0 && (c->data()[0] & 0x80)) return {};
+		if (c->size() > sizeof(std::uintmax_t) && c->data()[0] != 0) return {};
+		return argdata_format::read_int(c->data(), c->size());
+	}
+	optional<string_view> get_str() const {
+		auto c = contents(argdata_format::tag::str);
+		if (!c || c->size() == 0 || c->data()[c->size() - 1] != '\0') return {};
+		return string_view(reinterpret_cast<char const *>(c->data()), c->size() - 1);
+	}
+
+	// Same as above, but return a default value (empty/zero/etc.) instead of nullopt.
+	range<unsigned char const> as_binary() const { return get_binary().value_or(range<unsigned char const>{}); }
+	bool                       as_bool  () const { return get_bool  ().value_or(                       false); }
+	int                        as_fd    () const { return get_fd    ().value_or(                          -1); }
+	double                     as_float () const { return get_float ().value_or(                         0.0); }
+	std::intmax_t              as_int   () const { return get_int   ().value_or(                           0); }
+	std::uintmax_t             as_uint  () const { return get_uint  ().value_or(                           0); }
+	string_view                as_str   () const { return get_str   ().value_or(               string_view{}); }
+
+	// The encoded elements of a map (keys and values interleaved) or a
+	// sequence, or nullopt if this is neither.
+	optional<range<unsigned char const>> get_map_contents() const {
+		return contents(argdata_format::tag::map);
+	}
+	optional<range<unsigned char const>> get_seq_contents() const {
+		return contents(argdata_format::tag::seq);
+	}
+
+	class map_iterator;
+	class seq_iterator;
+	class map;
+	class seq;
+
+	optional<map> get_map() const;
+	optional<seq> get_seq() const;
+
+	map as_map() const;
+	seq as_seq() const;
+
+};
+
+// Unlike argdata_t's iterators, these don't contain the value they point at,
+// only its position in the buffer, so they are trivially copyable. Malformed
+// elements end the iteration.
+
+class argdata_view::map_iterator {
+public:
+	// Like std::pair, which isn't trivially copyable.
+	struct value_type {
+		argdata_view first;
+		argdata_view second;
+	};
+	using difference_type = std::ptrdiff_t;
+	using pointer = value_type const *;
+	using reference = value_type const &;
+	using iterator_category = std::forward_iterator_tag;
+private:
+	value_type value_;
+	unsigned char const *next_ = nullptr;
+	unsigned char const *end_ = nullptr;
+	friend map;
+public:
+	map_iterator() {}
+	reference operator*() const { return value_; }
+	pointer operator->() const { return &value_; }
+	map_iterator &operator++() {
+		std::size_t key_len, value_len;
+		unsigned char const *key = next_;
+		if (
+			next_ != end_ &&
+			argdata_format::read_subfield_length(key, end_, key_len) &&
+			(next_ = key + key_len, argdata_format::read_subfield_length(next_, end_, value_len))
+		) {
+			value_.first = argdata_view(range<unsigned char const>(key, key_len));
+			value_.second = argdata_view(range<unsigned char const>(next_, value_len));
+			next_ += value_len;
+		} else {
+			*this = map_iterator();
+		}
+		return *this;
+	}
+	map_iterator operator++(int) {
+		map_iterator copy = *this;
+		++*this;
+		return copy;
+	}
+	friend bool operator==(map_iterator const &a, map_iterator const &b) {
+		return a.next_ == b.next_;
+	}
+	friend bool operator!=(map_iterator const &a, map_iterator const &b) {
+		return !(a == b);
+	}
+};
+
+class argdata_view::seq_iterator {
+public:
+	using value_type = argdata_view;
+	using difference_type = std::ptrdiff_t;
+	using pointer = value_type const *;
+	using reference = value_type const &;
+	using iterator_category = std::forward_iterator_tag;
+private:
+	value_type value_;
+	unsigned char const *next_ = nullptr;
+	unsigned char const *end_ = nullptr;
+	friend seq;
+public:
+	seq_iterator() {}
+	reference operator*() const { return value_; }
+	pointer operator->() const { return &value_; }
+	seq_iterator &operator++() {
+		std::size_t len;
+		if (next_ != end_ && argdata_format::read_subfield_length(next_, end_, len)) {
+			value_ = argdata_view(range<unsigned char const>(next_, len));
+			next_ += len;
+		} else {
+			*this = seq_iterator();
+		}
+		return *this;
+	}
+	seq_iterator operator++(int) {
+		seq_iterator copy = *this;
+		++*this;
+		return copy;
+	}
+	friend bool operator==(seq_iterator const &a, seq_iterator const &b) {
+		return a.next_ == b.next_;
+	}
+	friend bool operator!=(seq_iterator const &a, seq_iterator const &b) {
+		return !(a == b);
+	}
+};
+
+class argdata_view::map {
+private:
+	range<unsigned char const> contents_;
+	friend argdata_view;
+public:
+	map_iterator begin() const {
+		map_iterator i;
+		i.next_ = contents_.data();
+		i.end_ = contents_.data() + contents_.size();
+		++i;
+		return i;
+	}
+	map_iterator end() const { return {}; }
+};
+
+class argdata_view::seq {
+private:
+	range<unsigned char const> contents_;
+	friend argdata_view;
+public:
+	seq_iterator begin() const {
+		seq_iterator i;
+		i.next_ = contents_.data();
+		i.end_ = contents_.data() + contents_.size();
+		++i;
+		return i;
+	}
+	seq_iterator end() const { return {}; }
+};
+
+inline optional<argdata_view::map> argdata_view::get_map() const {
+	auto c = get_map_contents();
+	if (!c) return {};
+	map r;
+	r.contents_ = *c;
+	return r;
+}
+
+inline optional<argdata_view::seq> argdata_view::get_seq() const {
+	auto c = get_seq_contents();
+	if (!c) return {};
+	seq r;
+	r.contents_ = *c;
+	return r;
+}
+
+inline argdata_view::map argdata_view::as_map() const { return get_map().value_or(map{}); }
+inline argdata_view::seq argdata_view::as_seq() const { return get_seq().value_or(seq{}); }
+
+static_assert(std::is_trivially_copyable<argdata_view::map_iterator>::value, "");
+static_assert(std::is_trivially_copyable<argdata_view::seq_iterator>::value, "");
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <mstd/range.hpp>
+
+#include "error_or.hpp"
+#include "fd.hpp"
+#include "fd_impl.hpp"
+#include "iovec.hpp"
+#include "structs.hpp"
+#include "types.hpp"
+
+namespace cloudabi {
+
+using mstd::range;
+
+enum class file_op {
+	pread,
+	pwrite,
+	datasync,
+	stat_fget,
+};
+
+struct file_request {
+	userdata userdata;
+	file_op op;
+	fd file;
+	// The data to read into or write from, which must stay valid until the
+	// request completes.
+	range<unsigned char> buffer;
+	filesize offset;
+
+	static file_request pread(cloudabi::userdata u, fd f, iovec buffer, filesize offset) {
+		return {u, file_op::pread, f, range<unsigned char>(buffer.data(), buffer.size()), offset};
+	}
+
+	static file_request pwrite(cloudabi::userdata u, fd f, ciovec data, filesize offset) {
+		unsigned char *p = const_cast<unsigned char *>(data.data());
+		return {u, file_op::pwrite, f, range<unsigned char>(p, data.size()), offset};
+	}
+
+	static file_request datasync(cloudabi::userdata u, fd f) {
+		return {u, file_op::datasync, f, {}, 0};
+	}
+
+	static file_request stat_fget(cloudabi::userdata u, fd f) {
+		return {u, file_op::stat_fget, f, {}, 0};
+	}
+};
+
+struct file_completion {
+	userdata userdata;
+	file_op op;
+	// The number of bytes read or written, or zero for other operations.
+	error_or<size_t> result = size_t(0);
+	// Only for file_op::stat_fget.
+	filestat stat;
+};
+
+// Runs blocking file operations on a pool of threads, for event loops that
+// must not block on regular files.
+//
+// Requests are queued, and every worker takes up to batch_size of them at a
+// time, but no more than its share of the queue, so that a burst of requests
+// is spread over all workers. Completions are queued in turn, and collected
+// by reap() in the order they finished, each carrying the userdata of its
+// request.
+//
+// The event loop learns about completions by polling notify_fd() for
+// reading, next to its other file descriptors. A single byte is written to
+// it when the completion queue becomes non-empty, and read again by the
+// reap() that empties it, so a single socket serves any number of
+// outstanding requests. Event loops without file descriptors use wait()
+// instead. cloudabi::poll() can't be used to wait for a condition variable
+// or lock together with file descriptors, which is why a socket is used.
+class async_file_io {
+
+public:
+	// Zero threads uses one thread per core.
+	explicit async_file_io(size_t threads = 0, size_t batch_size = 64)
+		: batch_size_(std::max<size_t>(batch_size, 1)) {
+		auto sockets = fd::create2(filetype::socket_stream);
+		if (sockets) {
+			notify_read_ = std::move(sockets->first);
+			notify_write_ = std::move(sockets->second);
+		}
+		n_workers_ = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+		for (size_t i = 0; i < n_workers_; ++i) workers_.emplace_back([this] { run(); });
+	}
+
+	async_file_io(async_file_io const &) = delete;
+	async_file_io &operator=(async_file_io const &) = delete;
+
+	// Finishes all queued requests. Completions that haven't been reaped are
+	// dropped.
+	~async_file_io() {
+		{
+			std::lock_guard<std::mutex> lock(requests_mutex_);
+			stopping_ = true;
+		}
+		requests_cv_.notify_all();
+		for (std::thread &t : workers_) t.join();
+	}
+
+	// Becomes readable when there are completions to reap. Invalid if the
+	// socket couldn't be created.
+	fd notify_fd() const { return notify_read_.get(); }
+
+	void submit(file_request const &request) {
+		{
+			std::lock_guard<std::mutex> lock(requests_mutex_);
+			requests_.push_back(request);
+			++outstanding_;
+		}
+		requests_cv_.notify_one();
+	}
+
+	void submit(range<file_request const> requests) {
+		if (requests.size() == 0) return;
+		{
+			std::lock_guard<std::mutex> lock(requests_mutex_);
+			requests_.insert(requests_.end(), requests.begin(), requests.end());
+			outstanding_ += requests.size();
+		}
+		requests_cv_.notify_all();
+	}
+
+	// The number of requests that have been submitted but not reaped.
+	size_t outstanding() const {
+		std::lock_guard<std::mutex> lock(requests_mutex_);
+		return outstanding_;
+	}
+
+	// Moves up to out.size() completions into out, without blocking. Returns
+	// the number of completions moved.
+	size_t reap(range<file_completion> out) {
+		std::lock_guard<std::mutex> lock(completions_mutex_);
+		size_t n = std::min(out.size(), completions_.size());
+		std::move(completions_.begin(), completions_.begin() + n, out.begin());
+		completions_.erase(completions_.begin(), completions_.begin() + n);
+		if (completions_.empty() && signaled_) {
+			unsigned char byte;
+			fd notify = notify_read_.get();
+			notify.read(iovec(&byte, 1));
+			signaled_ = false;
+		}
+		if (n > 0) {
+			std::lock_guard<std::mutex> lock(requests_mutex_);
+			outstanding_ -= n;
+		}
+		return n;
+	}
+
+	// Blocks until at least one completion has been reaped, unless out is
+	// empty. Waits again if another thread reaps the completions first.
+	size_t wait(range<file_completion> out) {
+		if (out.size() == 0) return 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(completions_mutex_);
+				completions_cv_.wait(lock, [this] { return !completions_.empty(); });
+			}
+			size_t n = reap(out);
+			if (n > 0) return n;
+		}
+	}
+
+private:
+	size_t batch_size_;
+	size_t n_workers_;
+	std::vector<std::thread> workers_;
+
+	mutable std::mutex requests_mutex_;
+	std::condition_variable requests_cv_;
+	std::deque<file_request> requests_;
+	size_t outstanding_ = 0;
+	bool stopping_ = false;
+
+	std::mutex completions_mutex_;
+	std::condition_variable completions_cv_;
+	std::deque<file_completion> completions_;
+	// Whether there is a byte in the socket, which is the case exactly when
+	// there are completions.
+	bool signaled_ = false;
+	unique_fd notify_read_;
+	unique_fd notify_write_;
+
+	void run() {
+		std::vector<file_request> batch;
+		std::vector<file_completion> done;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(requests_mutex_);
+				requests_cv_.wait(lock, [this] { return stopping_ || !requests_.empty(); });
+				if (requests_.empty()) return;
+				// Leave a fair share for the other workers.
+				size_t share = (requests_.size() + n_workers_ - 1) / n_workers_;
+				size_t n = std::min(share, batch_size_);
+				batch.assign(requests_.begin(), requests_.begin() + n);
+				requests_.erase(requests_.begin(), requests_.begin() + n);
+			}
+			done.clear();
+			for (file_request const &r : batch) done.push_back(execute(r));
+			std::lock_guard<std::mutex> lock(completions_mutex_);
+			completions_.insert(completions_.end(), done.begin(), done.end());
+			if (!signaled_) {
+				unsigned char byte = 0;
+				fd notify = notify_write_.get();
+				notify.write(ciovec(&byte, 1));
+				signaled_ = true;
+			}
+			completions_cv_.notify_all();
+		}
+	}
+
+	static file_completion execute(file_request const &r) {
+		file_completion c{r.userdata, r.op, size_t(0), {}};
+		fd f = r.file;
+		switch (r.op) {
+			case file_op::pread:
+				c.result = f.pread(iovec(r.buffer.data(), r.buffer.size()), r.offset);
+				break;
+			case file_op::pwrite:
+				c.result = f.pwrite(ciovec(r.buffer.data(), r.buffer.size()), r.offset);
+				break;
+			case file_op::datasync: {
+				auto s = f.datasync();
+				if (!s) c.result = s.error();
+				break;
+			}
+			case file_op::stat_fget: {
+				auto s = f.file_stat_fget();
+				if (s) c.stat = *s; else c.result = s.error();
+				break;
+			}
+		}
+		return c;
+	}
+
+};
+
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+#include <mstd/range.hpp>
+
+#include "error_or.hpp"
+#include "fd.hpp"
+#include "fd_impl.hpp"
+#include "iovec.hpp"
+#include "types.hpp"
+
+namespace cloudabi {
+
+using mstd::range;
+
+// Reads from a file descriptor through a buffer, so that many small reads
+// cost a single read syscall.
+//
+// Data is handed out as views into the buffer, which stay valid until the
+// next call that reads from the file descriptor. Does not own the file
+// descriptor.
+class buffered_reader {
+
+private:
+	fd fd_;
+	std::unique_ptr<unsigned char[]> buffer_;
+	size_t capacity_;
+	size_t begin_ = 0;
+	size_t end_ = 0;
+	bool eof_ = false;
+
+	// Reads once into the free space after the buffered data, making room
+	// for at least min_space bytes first.
+	error_or<size_t> fill(size_t min_space) {
+		if (capacity_ - end_ < min_space) {
+			if (begin_ > 0) {
+				std::memmove(buffer_.get(), buffer_.get() + begin_, end_ - begin_);
+				end_ -= begin_;
+				begin_ = 0;
+			}
+			if (capacity_ - end_ < min_space) {
+				size_t new_capacity = std::max(2 * capacity_, end_ + min_space);
+				std::unique_ptr<unsigned char[]> b(new unsigned char[new_capacity]);
+				std::memcpy(b.get(), buffer_.get(), end_);
+				buffer_ = std::move(b);
+				capacity_ = new_capacity;
+			}
+		}
+		auto n = fd_.read(iovec(buffer_.get() + end_, capacity_ - end_));
+		if (!n) return n.error();
+		if (*n == 0) eof_ = true;
+		end_ += *n;
+		return *n;
+	}
+
+public:
+	explicit buffered_reader(fd f, size_t buffer_size = 65536)
+		: fd_(f), buffer_(new unsigned char[buffer_size]), capacity_(buffer_size) {}
+
+	fd get_fd() const { return fd_; }
+
+	// Whether the end of the file has been reached.
+	bool eof() const { return eof_; }
+
+	// The data that is buffered, without reading anything.
+	range<unsigned char const> buffered() const {
+		return {buffer_.get() + begin_, end_ - begin_};
+	}
+
+	// Returns the buffered data, after reading until at least n bytes are
+	// buffered, or until the end of the file. The buffer grows if n is
+	// larger than its capacity.
+	error_or<range<unsigned char const>> peek(size_t n = 1) {
+		while (end_ - begin_ < n && !eof_) {
+			auto r = fill(n - (end_ - begin_));
+			if (!r) return r.error();
+		}
+		return buffered();
+	}
+
+	// Drops the first n bytes of the buffered data.
+	void consume(size_t n) {
+		begin_ += std::min(n, end_ - begin_);
+		if (begin_ == end_) begin_ = end_ = 0;
+	}
+
+	// Returns the data up to and including the first occurrence of delim,
+	// and consumes it. At the end of the file, returns the remaining data,
+	// which is empty once everything has been read. The buffer grows to fit
+	// the result.
+	error_or<range<unsigned char const>> read_until(unsigned char delim) {
+		size_t searched = 0;
+		for (;;) {
+			unsigned char const *start = buffer_.get() + begin_;
+			void const *found = std::memchr(start + searched, delim, end_ - begin_ - searched);
+			if (found || eof_) {
+				size_t len = found
+					? static_cast<unsigned char const *>(found) + 1 - start
+					: end_ - begin_;
+				// Don't reset the buffer in consume(), as the result still
+				// points into it.
+				begin_ += len;
+				return range<unsigned char const>(start, len);
+			}
+			searched = end_ - begin_;
+			auto r = fill(1);
+			if (!r) return r.error();
+		}
+	}
+
+	// Copies up to out.size() bytes. Reads that are at least as large as the
+	// buffer bypass it when nothing is buffered.
+	error_or<size_t> read(iovec out) {
+		if (begin_ == end_) {
+			if (eof_) return size_t(0);
+			if (out.size() >= capacity_) {
+				auto n = fd_.read(out);
+				if (n && *n == 0) eof_ = true;
+				return n;
+			}
+			auto r = fill(1);
+			if (!r) return r.error();
+		}
+		size_t n = std::min(out.size(), end_ - begin_);
+		std::memcpy(out.data(), buffer_.get() + begin_, n);
+		consume(n);
+		return n;
+	}
+
+};
+
+// Writes to a file descriptor through a buffer, so that many small writes
+// cost a single write syscall.
+//
+// Buffered data is only written by flush(), when the buffer is full, or when
+// the writer is destroyed, in which case errors are ignored. Writes larger
+// than the buffer are passed on together with the buffered data, using a
+// single vectored write. Does not own the file descriptor.
+class buffered_writer {
+
+private:
+	fd fd_;
+	std::unique_ptr<unsigned char[]> buffer_;
+	size_t capacity_;
+	size_t used_ = 0;
+	size_t written_ = 0;
+
+	// Writes the buffered data followed by extra, until all of it is written.
+	// On failure, keeps the part of the buffer that wasn't written, and sets
+	// written_ to the part of extra that was.
+	error_or<void> write_through(ciovec extra) {
+		size_t done = 0;
+		size_t total = used_ + extra.size();
+		while (done < total) {
+			ciovec iov[2];
+			size_t n_iov = 0;
+			if (done < used_) iov[n_iov++] = ciovec(buffer_.get() + done, used_ - done);
+			size_t extra_done = done > used_ ? done - used_ : 0;
+			if (extra_done < extra.size()) {
+				iov[n_iov++] = ciovec(extra.data() + extra_done, extra.size() - extra_done);
+			}
+			auto n = fd_.write(range<ciovec const>(iov, n_iov));
+			// A write that makes no progress would otherwise be retried
+			// forever.
+			if (n && *n == 0) n = error::io;
+			if (!n) {
+				// Keep whatever part of the buffer hasn't been written.
+				if (done > 0 && done < used_) {
+					std::memmove(buffer_.get(), buffer_.get() + done, used_ - done);
+				}
+				used_ = done < used_ ? used_ - done : 0;
+				written_ = extra_done;
+				return n.error();
+			}
+			done += *n;
+		}
+		used_ = 0;
+		return {};
+	}
+
+public:
+	explicit buffered_writer(fd f, size_t buffer_size = 65536)
+		: fd_(f), buffer_(new unsigned char[buffer_size]), capacity_(buffer_size) {}
+
+	buffered_writer(buffered_writer const &) = delete;
+	buffered_writer &operator=(buffered_writer const &) = delete;
+
+	~buffered_writer() { flush(); }
+
+	fd get_fd() const { return fd_; }
+
+	// The number of bytes waiting to be written.
+	size_t buffered() const { return used_; }
+
+	// How much of the data passed to the last write() was written or
+	// buffered. After a failed write(), the rest of it was dropped.
+	size_t written() const { return written_; }
+
+	error_or<void> write(ciovec data) {
+		written_ = 0;
+		if (data.size() <= capacity_ - used_) {
+			std::memcpy(buffer_.get() + used_, data.data(), data.size());
+			used_ += data.size();
+			written_ = data.size();
+			return {};
+		}
+		if (data.size() >= capacity_) {
+			auto r = write_through(data);
+			if (r) written_ = data.size();
+			return r;
+		}
+		auto r = write_through({});
+		if (!r) return r;
+		std::memcpy(buffer_.get(), data.data(), data.size());
+		used_ = data.size();
+		written_ = data.size();
+		return {};
+	}
+
+	// Returns space for at least n bytes to write into directly, flushing
+	// first if needed. n must not exceed the buffer size.
+	error_or<range<unsigned char>> prepare(size_t n) {
+		if (capacity_ - used_ < n) {
+			auto r = write_through({});
+			if (!r) return r.error();
+		}
+		return range<unsigned char>(buffer_.get() + used_, capacity_ - used_);
+	}
+
+	// Marks n bytes of the space returned by prepare() as written.
+	void commit(size_t n) { used_ += n; }
+
+	error_or<void> flush() {
+		if (used_ == 0) return {};
+		return write_through({});
+	}
+
+};
+
+}
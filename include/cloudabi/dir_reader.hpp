@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory>
+
+#include <mstd/optional.hpp>
+#include <mstd/range.hpp>
+#include <mstd/string_view.hpp>
+
+#include "error_or.hpp"
+#include "fd.hpp"
+#include "fd_impl.hpp"
+#include "structs.hpp"
+#include "types.hpp"
+
+namespace cloudabi {
+
+using mstd::optional;
+using mstd::range;
+using mstd::string_view;
+
+// Lists a directory using fd::file_readdir().
+//
+// Every syscall fills the whole buffer with as many entries as fit, which
+// are then returned one by one without copying their names. When the buffer
+// runs out, reading continues at the cookie of the last complete entry. The
+// buffer only grows if a single entry doesn't fit in it, so a directory of
+// any size is listed without allocating per entry.
+//
+// Names are views into the buffer, valid until the next entry is read. Does
+// not own the file descriptor.
+class dir_reader {
+
+public:
+	struct entry {
+		// The cookie to continue reading after this entry.
+		dircookie next;
+		inode ino;
+		filetype type;
+		string_view name;
+	};
+
+	class iterator;
+
+	explicit dir_reader(fd dir, size_t buffer_size = 65536, dircookie start = dircookie::start)
+		: dir_(dir),
+		  capacity_(std::max(buffer_size, sizeof(dirent) + 256)),
+		  buffer_(new unsigned char[capacity_]),
+		  cookie_(start) {}
+
+	fd get_fd() const { return dir_; }
+
+	// The cookie to continue reading after the last returned entry, which
+	// can be given to seek() or to a new reader later.
+	dircookie cookie() const { return cookie_; }
+
+	void seek(dircookie cookie) {
+		cookie_ = cookie;
+		pos_ = used_ = 0;
+		end_ = false;
+	}
+
+	void rewind() { seek(dircookie::start); }
+
+	// Returns the next entry, or nullopt at the end of the directory.
+	error_or<optional<entry>> next() {
+		for (;;) {
+			if (used_ - pos_ >= sizeof(dirent)) {
+				dirent d;
+				std::memcpy(&d, buffer_.get() + pos_, sizeof(d));
+				size_t len = sizeof(dirent) + d.d_namlen;
+				if (used_ - pos_ >= len) {
+					char const *name = reinterpret_cast<char const *>(buffer_.get() + pos_ + sizeof(dirent));
+					pos_ += len;
+					cookie_ = d.d_next;
+					return optional<entry>(entry{d.d_next, d.d_ino, d.d_type, string_view(name, d.d_namlen)});
+				}
+				// The only entry in a full buffer is cut off.
+				if (pos_ == 0 && used_ == capacity_) grow(len);
+			}
+			if (end_) return optional<entry>();
+			auto n = dir_.file_readdir(range<unsigned char>(buffer_.get(), capacity_), cookie_);
+			if (!n) return n.error();
+			pos_ = 0;
+			used_ = *n;
+			// A buffer that isn't full holds the end of the directory.
+			end_ = used_ < capacity_;
+		}
+	}
+
+	// Iterates over the remaining entries. Iteration stops early on errors,
+	// which are available through status() afterwards.
+	iterator begin();
+	iterator end();
+
+	error_or<void> status() const { return status_; }
+
+private:
+	fd dir_;
+	size_t capacity_;
+	std::unique_ptr<unsigned char[]> buffer_;
+	size_t pos_ = 0;
+	size_t used_ = 0;
+	bool end_ = false;
+	dircookie cookie_;
+	error_or<void> status_;
+
+	void grow(size_t min_capacity) {
+		capacity_ = std::max(2 * capacity_, min_capacity);
+		buffer_.reset(new unsigned char[capacity_]);
+		pos_ = used_ = 0;
+	}
+
+};
+
+class dir_reader::iterator {
+public:
+	using value_type = entry;
+	using difference_type = std::ptrdiff_t;
+	using pointer = entry const *;
+	using reference = entry const &;
+	using iterator_category = std::input_iterator_tag;
+private:
+	dir_reader *reader_ = nullptr;
+	entry entry_;
+	friend dir_reader;
+	explicit iterator(dir_reader *reader) : reader_(reader) { ++*this; }
+public:
+	iterator() {}
+	reference operator*() const { return entry_; }
+	pointer operator->() const { return &entry_; }
+	iterator &operator++() {
+		auto e = reader_->next();
+		if (e && *e) {
+			entry_ = **e;
+		} else {
+			if (!e) reader_->status_ = e.error();
+			reader_ = nullptr;
+		}
+		return *this;
+	}
+	friend bool operator==(iterator const &a, iterator const &b) {
+		return a.reader_ == b.reader_;
+	}
+	friend bool operator!=(iterator const &a, iterator const &b) {
+		return !(a == b);
+	}
+};
+
+inline dir_reader::iterator dir_reader::begin() {
+	status_ = error_or<void>();
+	return iterator(this);
+}
+
+inline dir_reader::iterator dir_reader::end() { return {}; }
+
+}
@@ -106,7 +106,7 @@ public:
 		bool follow_symlinks = true
 	);
 
-	// TODO: file_readdir
+	error_or<size_t> file_readdir(range<unsigned char> buf, dircookie cookie = dircookie::start);
 
 	error_or<size_t> file_readlink(string_view path, range<char> buf);
 
@@ -144,6 +144,10 @@ public:
 
 	error_or<void> sock_listen(backlog);
 
+	error_or<recv_out> sock_recv(recv_in const &);
+
+	error_or<send_out> sock_send(send_in const &);
+
 	error_or<void> sock_shutdown(sdflags);
 
 	error_or<sockstat> sock_stat_get(ssflags = ssflags::none);
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include <mstd/string_view.hpp>
+
+#include "error_or.hpp"
+#include "fd.hpp"
+#include "fd_impl.hpp"
+#include "structs.hpp"
+#include "types.hpp"
+
+namespace cloudabi {
+
+using mstd::string_view;
+
+// Keeps files open after fd::file_open(), so that opening the same path
+// again relative to the same directory costs neither a lookup of the whole
+// path nor a new file descriptor.
+//
+// Entries are keyed by everything that is passed to file_open(), and handed
+// out as shared handles. At most max_fds entries are kept, evicting the
+// least recently used one. An evicted file is closed once the last handle to
+// it is dropped, so handles that are held on to count towards the number of
+// open files, but not towards the budget.
+//
+// With revalidate, a cached entry is only used if the path still refers to
+// the same file with the same modification time. That costs a
+// file_stat_get() of the path, which is still much cheaper than opening it.
+// Otherwise, the cache has to be told about changes through invalidate().
+//
+// Opens with oflags::trunc or oflags::excl are never cached, as they have
+// side effects that must happen every time.
+//
+// All handles to an entry share a single file descriptor, and with it a
+// single file offset, so they must only be used for operations that don't
+// use the offset, such as pread() and pwrite(). Opens with rights::fd_seek
+// or rights::fd_tell are never cached, as those only make sense for a file
+// descriptor with an offset of its own.
+class fd_cache {
+
+public:
+	using handle = std::shared_ptr<unique_fd const>;
+
+	explicit fd_cache(size_t max_fds = 256, bool revalidate = true)
+		: max_fds_(max_fds), revalidate_(revalidate) {}
+
+	error_or<handle> open(
+		fd dir,
+		string_view path,
+		rights base_rights,
+		oflags o = oflags::none,
+		fdflags f = fdflags::none,
+		rights inheriting_rights = rights::none,
+		bool follow_symlinks = true
+	) {
+		bool cacheable = (o & (oflags::trunc | oflags::excl)) == oflags::none &&
+			(base_rights & (rights::fd_seek | rights::fd_tell)) == rights::none;
+		key k{dir.number(), std::string(path.data(), path.size()), base_rights, inheriting_rights, o, f, follow_symlinks};
+		if (cacheable) {
+			if (auto h = lookup(dir, k)) return h;
+		}
+		auto file = dir.file_open(path, base_rights, o, f, inheriting_rights, follow_symlinks);
+		if (!file) return file.error();
+		std::shared_ptr<unique_fd> h = std::make_shared<unique_fd>(std::move(*file));
+		if (!cacheable) return handle(h);
+		fd opened = h->get();
+		auto stat = opened.file_stat_fget();
+		if (!stat && revalidate_) stat = dir.file_stat_get(path, follow_symlinks);
+		if (!stat && revalidate_) return handle(h);
+		insert(std::move(k), h, stat ? *stat : filestat());
+		return handle(h);
+	}
+
+	// Drops all entries for a path relative to dir, so that the next open()
+	// opens it again.
+	void invalidate(fd dir, string_view path) {
+		std::string p(path.data(), path.size());
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (auto i = lru_.begin(); i != lru_.end();) {
+			if (i->first.dir == dir.number() && i->first.path == p) {
+				index_.erase(i->first);
+				i = lru_.erase(i);
+			} else {
+				++i;
+			}
+		}
+	}
+
+	// Drops all entries relative to dir, such as before closing it.
+	void invalidate(fd dir) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (auto i = lru_.begin(); i != lru_.end();) {
+			if (i->first.dir == dir.number()) {
+				index_.erase(i->first);
+				i = lru_.erase(i);
+			} else {
+				++i;
+			}
+		}
+	}
+
+	void clear() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		index_.clear();
+		lru_.clear();
+	}
+
+	size_t size() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return lru_.size();
+	}
+
+	// The number of open() calls that were served from the cache, and that
+	// had to open the file.
+	std::uint64_t hits() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return hits_;
+	}
+
+	std::uint64_t misses() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return misses_;
+	}
+
+private:
+	struct key {
+		cloudabi_fd_t dir;
+		std::string path;
+		rights base_rights;
+		rights inheriting_rights;
+		oflags o;
+		fdflags f;
+		bool follow_symlinks;
+
+		friend bool operator==(key const &a, key const &b) {
+			return a.dir == b.dir && a.path == b.path &&
+				a.base_rights == b.base_rights &&
+				a.inheriting_rights == b.inheriting_rights &&
+				a.o == b.o && a.f == b.f && a.follow_symlinks == b.follow_symlinks;
+		}
+	};
+
+	struct key_hash {
+		size_t operator()(key const &k) const {
+			size_t h = std::hash<std::string>()(k.path);
+			h = h * 31 + std::hash<cloudabi_fd_t>()(k.dir);
+			h = h * 31 + std::hash<cloudabi_rights_t>()(cloudabi_rights_t(k.base_rights));
+			h = h * 31 + std::hash<cloudabi_rights_t>()(cloudabi_rights_t(k.inheriting_rights));
+			h = h * 31 + std::hash<cloudabi_oflags_t>()(cloudabi_oflags_t(k.o));
+			h = h * 31 + std::hash<cloudabi_fdflags_t>()(cloudabi_fdflags_t(k.f));
+			h = h * 31 + (k.follow_symlinks ? 1 : 0);
+			return h;
+		}
+	};
+
+	struct entry {
+		std::shared_ptr<unique_fd> file;
+		// The identity and modification time of the file when it was opened.
+		device dev;
+		inode ino;
+		timestamp mtim;
+	};
+
+	using lru_list = std::list<std::pair<key, entry>>;
+
+	size_t max_fds_;
+	bool revalidate_;
+
+	mutable std::mutex mutex_;
+	// Most recently used first.
+	lru_list lru_;
+	std::unordered_map<key, lru_list::iterator, key_hash> index_;
+	std::uint64_t hits_ = 0;
+	std::uint64_t misses_ = 0;
+
+	handle lookup(fd dir, key const &k) {
+		entry e;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			auto i = index_.find(k);
+			if (i == index_.end()) {
+				++misses_;
+				return nullptr;
+			}
+			e = i->second->second;
+			if (!revalidate_) {
+				lru_.splice(lru_.begin(), lru_, i->second);
+				++hits_;
+				return e.file;
+			}
+		}
+		// Stat the path without holding the lock.
+		auto stat = dir.file_stat_get(string_view(k.path.data(), k.path.size()), k.follow_symlinks);
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto i = index_.find(k);
+		bool valid = stat && stat->st_dev == e.dev && stat->st_ino == e.ino && stat->st_mtim == e.mtim;
+		if (i == index_.end() || i->second->second.file != e.file) {
+			// Replaced or dropped in the meantime.
+			++misses_;
+			return nullptr;
+		}
+		if (!valid) {
+			lru_.erase(i->second);
+			index_.erase(i);
+			++misses_;
+			return nullptr;
+		}
+		lru_.splice(lru_.begin(), lru_, i->second);
+		++hits_;
+		return e.file;
+	}
+
+	void insert(key k, std::shared_ptr<unique_fd> file, filestat const &stat) {
+		if (max_fds_ == 0) return;
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto i = index_.find(k);
+		if (i != index_.end()) {
+			lru_.erase(i->second);
+			index_.erase(i);
+		}
+		lru_.emplace_front(k, entry{std::move(file), stat.st_dev, stat.st_ino, stat.st_mtim});
+		index_.emplace(std::move(k), lru_.begin());
+		while (lru_.size() > max_fds_) {
+			index_.erase(lru_.back().first);
+			lru_.pop_back();
+		}
+	}
+
+};
+
+}
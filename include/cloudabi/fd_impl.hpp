@@ -32,7 +32,7 @@ inline  error_or<unique_fd> fd::create1(filetype ft) {
 
 inline  error_or<std::pair<unique_fd, unique_fd>> fd::create2(filetype ft) {
 	fd a, b;
-	if (auto err = cloudabi_sys_fd_create2(cloudabi_filetype_t(ft), &b.fd_, &b.fd_)) {
+	if (auto err = cloudabi_sys_fd_create2(cloudabi_filetype_t(ft), &a.fd_, &b.fd_)) {
 		return error(err);
 	} else {
 		return std::make_pair(unique_fd(a), unique_fd(b));
@@ -188,6 +188,15 @@ inline error_or<unique_fd> fd::file_open(
 	}
 }
 
+inline error_or<size_t> fd::file_readdir(range<unsigned char> buf, dircookie cookie) {
+	size_t bufused;
+	if (auto err = cloudabi_sys_file_readdir(fd_, buf.data(), buf.size(), cloudabi_dircookie_t(cookie), &bufused)) {
+		return error(err);
+	} else {
+		return bufused;
+	}
+}
+
 inline error_or<size_t> fd::file_readlink(string_view path, range<char> buf) {
 	size_t bufused;
 	if (auto err = cloudabi_sys_file_readlink(fd_, path.data(), path.size(), buf.data(), buf.size(), &bufused)) {
@@ -287,6 +296,24 @@ inline error_or<void> fd::sock_listen(backlog bl) {
 	return error(cloudabi_sys_sock_listen(fd_, bl));
 }
 
+inline error_or<recv_out> fd::sock_recv(recv_in const & in) {
+	recv_out out;
+	if (auto err = cloudabi_sys_sock_recv(fd_, (cloudabi_recv_in_t const *)&in, (cloudabi_recv_out_t *)&out)) {
+		return error(err);
+	} else {
+		return out;
+	}
+}
+
+inline error_or<send_out> fd::sock_send(send_in const & in) {
+	send_out out;
+	if (auto err = cloudabi_sys_sock_send(fd_, (cloudabi_send_in_t const *)&in, (cloudabi_send_out_t *)&out)) {
+		return error(err);
+	} else {
+		return out;
+	}
+}
+
 inline error_or<void> fd::sock_shutdown(sdflags how) {
 	return error(cloudabi_sys_sock_shutdown(fd_, cloudabi_sdflags_t(how)));
 }
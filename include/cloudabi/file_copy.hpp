@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <mstd/range.hpp>
+
+#include "error_or.hpp"
+#include "fd.hpp"
+#include "fd_impl.hpp"
+#include "iovec.hpp"
+#include "mem.hpp"
+#include "structs.hpp"
+#include "types.hpp"
+
+namespace cloudabi {
+
+using mstd::range;
+
+struct copy_progress {
+	// The chunk that was just finished.
+	filesize offset;
+	size_t size;
+	// The bytes copied so far, including this chunk, and the size of the
+	// file.
+	filesize copied;
+	filesize total;
+};
+
+enum class copy_mode {
+	// Map the source if both files are regular files, and read otherwise.
+	automatic,
+	// Read the source into a buffer per thread.
+	read,
+	// Map the source, one chunk at a time, and write from the mapping.
+	mem_map,
+};
+
+struct copy_options {
+	// Zero uses one thread per core.
+	size_t threads = 0;
+	// Rounded up to a multiple of file_copier::alignment.
+	size_t chunk_size = 1 << 20;
+	copy_mode mode = copy_mode::automatic;
+	// Whether to allocate the whole destination up front, so that it isn't
+	// fragmented by chunks that are written out of order. Failure to
+	// allocate is ignored.
+	bool preallocate = true;
+	// Called for every chunk, one at a time, with the result of copying it.
+	// After a chunk fails, no new chunks are started.
+	std::function<void(copy_progress const &, error_or<void> const &)> on_chunk;
+};
+
+// Copies the contents of one file to another, using positioned reads and
+// writes from a pool of threads.
+//
+// The file is split into chunks, which the threads take in order. Every
+// thread reads into a single page-aligned buffer, which is reused for all of
+// its chunks. The destination ends up with the size the source had when the
+// copy started. Neither file descriptor's offset is used.
+//
+// In mem_map mode, the size of the source is checked again before every
+// chunk is mapped, but a source that is truncated while a chunk is being
+// copied still causes a fault. Use copy_mode::read for files that might
+// shrink during the copy.
+class file_copier {
+
+public:
+	// Chunks start at multiples of this, so that they can be mapped.
+	static constexpr size_t alignment = 65536;
+
+	file_copier(fd from, fd to, copy_options options = {})
+		: from_(from), to_(to), options_(std::move(options)) {
+		options_.chunk_size = std::max<size_t>(
+			(options_.chunk_size + alignment - 1) / alignment * alignment, size_t(alignment));
+	}
+
+	// Blocks until the whole file has been copied. Returns the number of
+	// bytes copied, or the first error.
+	error_or<filesize> copy();
+
+private:
+	fd from_;
+	fd to_;
+	copy_options options_;
+	filesize total_ = 0;
+	size_t n_chunks_ = 0;
+	bool mapped_ = false;
+
+	std::atomic<size_t> next_chunk_{0};
+	std::atomic<bool> failed_{false};
+
+	std::mutex mutex_;
+	filesize copied_ = 0;
+	error_or<void> status_;
+
+	void run() {
+		range<unsigned char> buffer;
+		if (!mapped_) {
+			auto mem = mem_map(options_.chunk_size, mprot::read | mprot::write, mflags::anon | mflags::private_);
+			if (!mem) {
+				// Fail the chunk this thread would have copied, if any.
+				size_t i = next_chunk_.fetch_add(1);
+				if (i < n_chunks_) {
+					filesize offset = filesize(i) * options_.chunk_size;
+					finish(offset, chunk_size(offset), mem.error());
+				}
+				return;
+			}
+			buffer = range<unsigned char>(static_cast<unsigned char *>(*mem), options_.chunk_size);
+		}
+		while (!failed_.load()) {
+			size_t i = next_chunk_.fetch_add(1);
+			if (i >= n_chunks_) break;
+			filesize offset = filesize(i) * options_.chunk_size;
+			size_t size = chunk_size(offset);
+			finish(offset, size, mapped_ ? copy_mapped(offset, size) : copy_read(offset, size, buffer));
+		}
+		if (buffer.size() > 0) mem_unmap(buffer);
+	}
+
+	error_or<void> copy_read(filesize offset, size_t size, range<unsigned char> buffer) {
+		size_t have = 0;
+		while (have < size) {
+			auto n = from_.pread(iovec(buffer.data() + have, size - have), offset + have);
+			if (!n) return n.error();
+			// The source was truncated while copying.
+			if (*n == 0) break;
+			have += *n;
+		}
+		return write_all(offset, buffer.data(), have);
+	}
+
+	// Only maps the part of the chunk that is still within the source, as
+	// touching a mapping past the end of a file faults.
+	error_or<void> copy_mapped(filesize offset, size_t size) {
+		auto stat = from_.file_stat_fget();
+		if (!stat) return stat.error();
+		if (stat->st_size <= offset) return {};
+		size = size_t(std::min<filesize>(size, stat->st_size - offset));
+		auto mem = from_.mem_map(size, offset);
+		if (!mem) return mem.error();
+		range<unsigned char> data(static_cast<unsigned char *>(*mem), size);
+		mem_advise(data, advice::sequential);
+		auto r = write_all(offset, data.data(), size);
+		mem_unmap(data);
+		return r;
+	}
+
+	error_or<void> write_all(filesize offset, unsigned char const *data, size_t size) {
+		size_t done = 0;
+		while (done < size) {
+			auto n = to_.pwrite(ciovec(data + done, size - done), offset + done);
+			if (!n) return n.error();
+			if (*n == 0) return error::io;
+			done += *n;
+		}
+		return {};
+	}
+
+	size_t chunk_size(filesize offset) const {
+		return size_t(std::min<filesize>(options_.chunk_size, total_ - offset));
+	}
+
+	void finish(filesize offset, size_t size, error_or<void> result) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (result) {
+			copied_ += size;
+		} else {
+			failed_.store(true);
+			if (status_) status_ = result;
+		}
+		if (options_.on_chunk && size > 0) {
+			options_.on_chunk(copy_progress{offset, size, copied_, total_}, result);
+		}
+	}
+
+};
+
+inline error_or<filesize> file_copier::copy() {
+	auto from_stat = from_.file_stat_fget();
+	if (!from_stat) return from_stat.error();
+	auto to_stat = to_.file_stat_fget();
+	if (!to_stat) return to_stat.error();
+	total_ = from_stat->st_size;
+	n_chunks_ = size_t((total_ + options_.chunk_size - 1) / options_.chunk_size);
+	mapped_ = options_.mode == copy_mode::mem_map || (
+		options_.mode == copy_mode::automatic &&
+		from_stat->st_filetype == filetype::regular_file &&
+		to_stat->st_filetype == filetype::regular_file);
+
+	if (to_stat->st_size > total_) {
+		filestat stat;
+		stat.st_size = total_;
+		auto r = to_.file_stat_fput(stat, fsflags::size);
+		if (!r) return r.error();
+	}
+	if (options_.preallocate && total_ > 0) to_.file_allocate(0, total_);
+
+	size_t n_threads = options_.threads ? options_.threads : std::max(1u, std::thread::hardware_concurrency());
+	n_threads = std::max<size_t>(1, std::min<size_t>(n_threads, n_chunks_));
+	next_chunk_.store(0);
+	failed_.store(false);
+	copied_ = 0;
+	status_ = error_or<void>();
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < n_threads; ++i) threads.emplace_back([this] { run(); });
+	run();
+	for (std::thread &t : threads) t.join();
+
+	if (!status_) return status_.error();
+	return copied_;
+}
+
+// Copies the contents of one file to another with a file_copier.
+inline error_or<filesize> copy_file(fd from, fd to, copy_options options = {}) {
+	return file_copier(from, to, std::move(options)).copy();
+}
+
+}
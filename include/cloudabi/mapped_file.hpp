@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+#include <mstd/range.hpp>
+#include <mstd/string_view.hpp>
+
+#include "error_or.hpp"
+#include "fd.hpp"
+#include "fd_impl.hpp"
+#include "mem.hpp"
+#include "structs.hpp"
+#include "types.hpp"
+
+namespace cloudabi {
+
+using mstd::range;
+using mstd::string_view;
+
+// A whole file mapped into memory, unmapped when the mapped_file is
+// destroyed.
+//
+// Read-only mappings are private. Writable mappings are shared, so changes
+// end up in the file, but are only guaranteed to be written out by sync().
+// Unmapping doesn't sync.
+//
+// The mapping covers the size of the file at the time it was mapped. After
+// the file has grown or shrunk, remap() maps it again at its new size, which
+// moves the data to a new address. The last advice given is applied to the
+// new mapping as well. An empty file has no mapping.
+class mapped_file {
+
+public:
+	mapped_file() {}
+
+	mapped_file(mapped_file &&other) { swap(other); }
+
+	mapped_file &operator=(mapped_file &&other) {
+		mapped_file(std::move(other)).swap(*this);
+		return *this;
+	}
+
+	~mapped_file() { unmap(); }
+
+	void swap(mapped_file &other) {
+		std::swap(fd_, other.fd_);
+		std::swap(owned_, other.owned_);
+		std::swap(data_, other.data_);
+		std::swap(writable_, other.writable_);
+		std::swap(advice_, other.advice_);
+	}
+
+	// Opens and maps the file at path, relative to dir. The mapped_file owns
+	// the file descriptor, so that it can be remapped later.
+	static error_or<mapped_file> open(fd dir, string_view path, bool writable = false) {
+		rights r = rights::fd_read | rights::mem_map | rights::file_stat_fget;
+		if (writable) r = r | rights::fd_write | rights::file_stat_fput_size;
+		auto file = dir.file_open(path, r);
+		if (!file) return file.error();
+		auto f = map(file->get(), writable);
+		if (!f) return f.error();
+		f->owned_ = std::move(*file);
+		return f;
+	}
+
+	// Maps an open file. The file descriptor must stay open for as long as
+	// the mapped_file is remapped or resized, but isn't needed otherwise.
+	static error_or<mapped_file> map(fd file, bool writable = false) {
+		mapped_file f;
+		f.fd_ = file;
+		f.writable_ = writable;
+		auto r = f.remap();
+		if (!r) return r.error();
+		return f;
+	}
+
+	fd get_fd() const { return fd_; }
+
+	bool writable() const { return writable_; }
+
+	size_t size() const { return data_.size(); }
+
+	range<unsigned char const> data() const { return data_; }
+
+	// The mapping, to write to. Only for writable mappings.
+	range<unsigned char> mutable_data() const { return data_; }
+
+	// Advises the kernel how the mapping will be accessed. Only a hint, so
+	// failure can be ignored.
+	error_or<void> advise(advice a) {
+		advice_ = a;
+		if (data_.size() == 0) return {};
+		return mem_advise(data_, a);
+	}
+
+	// Advises the kernel about part of the mapping only. The offset must be
+	// a multiple of the page size.
+	error_or<void> advise(advice a, size_t offset, size_t len) {
+		if (offset >= data_.size()) return {};
+		if (len > data_.size() - offset) len = data_.size() - offset;
+		return mem_advise(range<unsigned char>(data_.data() + offset, len), a);
+	}
+
+	// Maps the file again if its size changed. Returns whether it did.
+	error_or<bool> remap() {
+		auto stat = fd_.file_stat_fget();
+		if (!stat) return stat.error();
+		if (stat->st_size > SIZE_MAX) return error::fbig;
+		size_t size = size_t(stat->st_size);
+		if (size == data_.size()) return false;
+		unmap();
+		if (size == 0) return true;
+		auto mem = writable_
+			? fd_.mem_map(size, 0, mprot::read | mprot::write, mflags::shared)
+			: fd_.mem_map(size);
+		if (!mem) return mem.error();
+		data_ = range<unsigned char>(static_cast<unsigned char *>(*mem), size);
+		if (advice_ != advice::normal) mem_advise(data_, advice_);
+		return true;
+	}
+
+	// Changes the size of the file and maps it again. Only for writable
+	// mappings.
+	error_or<void> resize(size_t size) {
+		filestat stat;
+		stat.st_size = size;
+		auto r = fd_.file_stat_fput(stat, fsflags::size);
+		if (!r) return r;
+		auto m = remap();
+		if (!m) return m.error();
+		return {};
+	}
+
+	// Writes changes to the file. Only for writable mappings.
+	error_or<void> sync(msflags flags = msflags::sync) {
+		if (data_.size() == 0) return {};
+		return mem_sync(data_, flags);
+	}
+
+private:
+	fd fd_;
+	unique_fd owned_;
+	range<unsigned char> data_;
+	bool writable_ = false;
+	advice advice_ = advice::normal;
+
+	void unmap() {
+		if (data_.size() > 0) mem_unmap(data_);
+		data_ = range<unsigned char>();
+	}
+
+};
+
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#include <mstd/range.hpp>
+
+#include "error_or.hpp"
+#include "fd.hpp"
+#include "fd_impl.hpp"
+#include "mem.hpp"
+#include "structs.hpp"
+#include "types.hpp"
+
+namespace cloudabi {
+
+using mstd::range;
+
+// Reads a file front to back through a window that is mapped into memory,
+// for scanning files that are too large to map as a whole.
+//
+// The window moves forward as data is consumed. Whenever a new window is
+// mapped, the kernel is advised to read the one after it ahead. With
+// drop_behind, consumed parts of the window are released and dropped from
+// the page cache as soon as they span an alignment unit, so that a single
+// scan doesn't push out other cached data. The memory used stays at about
+// one window.
+//
+// Data is handed out as views into the window, which stay valid until the
+// next call to next(). Does not own the file descriptor.
+class mapped_reader {
+
+public:
+	// Windows start at multiples of this, which is a multiple of the page
+	// size on all supported platforms.
+	static constexpr size_t alignment = 65536;
+
+	explicit mapped_reader(fd file, size_t window_size = 16 << 20, bool drop_behind = true)
+		: fd_(file),
+		  window_(std::max<size_t>((window_size + alignment - 1) / alignment * alignment, size_t(alignment))),
+		  drop_behind_(drop_behind) {}
+
+	mapped_reader(mapped_reader const &) = delete;
+	mapped_reader &operator=(mapped_reader const &) = delete;
+
+	~mapped_reader() { unmap(); }
+
+	fd get_fd() const { return fd_; }
+
+	// The offset in the file of the next byte to be returned.
+	filesize position() const { return pos_; }
+
+	// The size of the file as of the last call to refresh().
+	filesize size() const { return size_; }
+
+	bool eof() const { return sized_ && pos_ >= size_; }
+
+	// Gets the size of the file again, to continue reading a file that has
+	// grown. Called automatically by the first next().
+	error_or<void> refresh() {
+		auto stat = fd_.file_stat_fget();
+		if (!stat) return stat.error();
+		size_ = stat->st_size;
+		sized_ = true;
+		// The end of the file might have moved into or out of the window.
+		unmap();
+		return {};
+	}
+
+	// Returns the data from the current position to the end of the window,
+	// mapping a new window if fewer than min bytes are left in it. The result
+	// is only shorter than min at the end of the file, and empty once
+	// everything has been read.
+	error_or<range<unsigned char const>> next(size_t min = 1) {
+		if (!sized_) {
+			auto r = refresh();
+			if (!r) return r.error();
+		}
+		if (pos_ >= size_) return range<unsigned char const>();
+		filesize want = std::min<filesize>(pos_ + min, size_);
+		if (pos_ < map_off_ || want > map_off_ + map_.size()) {
+			auto r = map_window(want);
+			if (!r) return r.error();
+		}
+		size_t off = size_t(pos_ - map_off_);
+		return range<unsigned char const>(map_.data() + off, map_.size() - off);
+	}
+
+	// Marks n bytes from the current position as read.
+	void consume(size_t n) {
+		pos_ = std::min<filesize>(pos_ + n, size_);
+		if (drop_behind_ && map_.size() > 0) {
+			filesize done = std::min<filesize>(pos_, map_off_ + map_.size()) / alignment * alignment;
+			if (done > released_) {
+				release(released_, done);
+				released_ = done;
+			}
+		}
+	}
+
+	// Continues reading at another offset. Going backwards doesn't bring
+	// back released pages, which are simply read again.
+	void seek(filesize pos) { pos_ = sized_ ? std::min(pos, size_) : pos; }
+
+private:
+	fd fd_;
+	size_t window_;
+	bool drop_behind_;
+	bool sized_ = false;
+	filesize size_ = 0;
+	filesize pos_ = 0;
+
+	// The current window, and the start of the part of it that hasn't been
+	// released yet.
+	filesize map_off_ = 0;
+	range<unsigned char> map_;
+	filesize released_ = 0;
+
+	error_or<void> map_window(filesize want) {
+		unmap();
+		filesize off = pos_ / alignment * alignment;
+		filesize end = std::min<filesize>(std::max<filesize>(off + window_, want), size_);
+		if (end - off > SIZE_MAX) return error::fbig;
+		size_t len = size_t(end - off);
+		auto mem = fd_.mem_map(len, off);
+		if (!mem) return mem.error();
+		map_ = range<unsigned char>(static_cast<unsigned char *>(*mem), len);
+		map_off_ = released_ = off;
+		// Only hints, so failure is ignored.
+		mem_advise(map_, advice::sequential);
+		if (end < size_) {
+			fd_.file_advise(end, std::min<filesize>(window_, size_ - end), advice::willneed);
+		}
+		return {};
+	}
+
+	void unmap() {
+		if (map_.size() == 0) return;
+		filesize done = std::min<filesize>(pos_, map_off_ + map_.size());
+		if (drop_behind_ && done > released_) {
+			fd_.file_advise(released_, done - released_, advice::dontneed);
+		}
+		mem_unmap(map_);
+		map_ = range<unsigned char>();
+	}
+
+	// Releases part of the window, given as offsets in the file.
+	void release(filesize begin, filesize end) {
+		mem_advise(range<unsigned char>(map_.data() + (begin - map_off_), size_t(end - begin)), advice::dontneed);
+		fd_.file_advise(begin, end - begin, advice::dontneed);
+	}
+
+};
+
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include <mstd/range.hpp>
+
+#include "error_or.hpp"
+#include "fd.hpp"
+#include "fd_impl.hpp"
+#include "iovec.hpp"
+#include "structs.hpp"
+#include "types.hpp"
+
+namespace cloudabi {
+
+using mstd::range;
+
+// Sends several messages, each with its own data and file descriptors, over
+// a datagram or seqpacket socket. Stops at the first message that fails,
+// such as with error::again on a non-blocking socket. Returns the number of
+// messages sent, or the error if not even the first one was.
+inline error_or<size_t> sock_send_batch(fd sock, range<send_in const> messages) {
+	size_t n = 0;
+	for (send_in const &m : messages) {
+		auto r = sock.sock_send(m);
+		if (!r) {
+			if (n == 0) return r.error();
+			break;
+		}
+		++n;
+	}
+	return n;
+}
+
+// Receives several messages into buffers that are allocated once.
+//
+// Every message slot has room for max_size bytes of data and max_fds file
+// descriptors. Received file descriptors are owned by the batch until they
+// are moved out, and are closed by the next receive() otherwise.
+class recv_batch {
+
+public:
+	struct message {
+		range<unsigned char const> data;
+		range<unique_fd> fds;
+		// Includes msgflags::trunc or msgflags::ctrunc if the data or file
+		// descriptors didn't fit.
+		msgflags flags;
+	};
+
+	recv_batch(size_t max_messages, size_t max_size, size_t max_fds = 0)
+		: max_messages_(max_messages), max_size_(max_size), max_fds_(max_fds),
+		  data_(new unsigned char[max_messages * max_size]),
+		  raw_fds_(new fd[max_messages * max_fds]),
+		  fds_(new unique_fd[max_messages * max_fds]),
+		  messages_(new message[max_messages]) {}
+
+	// Receives up to max messages, at most the number of slots. Only the
+	// first receive may block: on a non-blocking socket, receiving stops
+	// once no more messages are available. On a blocking socket, use a max
+	// of one, or of the number of messages that are known to be available.
+	// Returns the number of messages received, or the error if not even the
+	// first one was.
+	error_or<size_t> receive(fd sock, size_t max = SIZE_MAX, msgflags flags = msgflags::none) {
+		if (max > max_messages_) max = max_messages_;
+		for (size_t i = 0; i < count_; ++i) {
+			for (unique_fd &f : messages_[i].fds) f = unique_fd();
+		}
+		count_ = 0;
+		while (count_ < max) {
+			size_t i = count_;
+			iovec data(data_.get() + i * max_size_, max_size_);
+			recv_in in;
+			in.ri_data = range<iovec const>(data);
+			in.ri_fds = range<fd>(raw_fds_.get() + i * max_fds_, max_fds_);
+			in.ri_flags = flags;
+			auto r = sock.sock_recv(in);
+			if (!r) {
+				if (count_ == 0) return r.error();
+				break;
+			}
+			unique_fd *fds = fds_.get() + i * max_fds_;
+			for (size_t j = 0; j < r->ro_fdslen; ++j) fds[j] = unique_fd(in.ri_fds[j]);
+			messages_[i] = message{
+				range<unsigned char const>(data.data(), r->ro_datalen < max_size_ ? r->ro_datalen : max_size_),
+				range<unique_fd>(fds, r->ro_fdslen),
+				r->ro_flags
+			};
+			++count_;
+			// A stream socket returns nothing at the end of the stream.
+			if (r->ro_datalen == 0 && r->ro_fdslen == 0) break;
+		}
+		return count_;
+	}
+
+	// The messages received by the last receive().
+	size_t size() const { return count_; }
+
+	message const &operator[](size_t i) const { return messages_[i]; }
+
+	message const *begin() const { return messages_.get(); }
+	message const *end() const { return messages_.get() + count_; }
+
+private:
+	size_t max_messages_;
+	size_t max_size_;
+	size_t max_fds_;
+	size_t count_ = 0;
+	std::unique_ptr<unsigned char[]> data_;
+	std::unique_ptr<fd[]> raw_fds_;
+	std::unique_ptr<unique_fd[]> fds_;
+	std::unique_ptr<message[]> messages_;
+
+};
+
+}
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <mstd/string_view.hpp>
+
+#include "clock.hpp"
+#include "dir_reader.hpp"
+#include "error_or.hpp"
+#include "fd.hpp"
+#include "fd_impl.hpp"
+#include "structs.hpp"
+#include "types.hpp"
+
+namespace cloudabi {
+
+using mstd::string_view;
+
+struct stat_cache_options {
+	// How long entries stay valid, in nanoseconds of the monotonic clock.
+	// Zero keeps them until they are invalidated explicitly.
+	timestamp ttl = 0;
+	// The number of independently locked parts of the table.
+	size_t shards = 16;
+	// Whether to remember that paths don't exist.
+	bool cache_noent = true;
+};
+
+struct stat_cache_stats {
+	std::uint64_t hits;
+	std::uint64_t misses;
+	// Misses because the entry was older than the ttl.
+	std::uint64_t expired;
+	std::uint64_t invalidated;
+	std::uint64_t prefetched;
+};
+
+// Caches the results of fd::file_stat_get(), keyed by directory, path and
+// whether symbolic links are followed.
+//
+// Entries live in flat open-addressing hash tables, one per shard, that
+// store the hash of every key next to it, so that a lookup compares paths
+// only for the entry it finds. Lookups of different shards don't contend.
+//
+// The cache doesn't notice changes to the file system by itself. Entries are
+// dropped by invalidate(), or expire after the ttl, which costs a
+// clock_time_get() per lookup. Stats run without holding a lock, and their
+// results aren't cached if an invalidation of their shard happened in the
+// meantime.
+class stat_cache {
+
+public:
+	explicit stat_cache(stat_cache_options options = {})
+		: options_(std::move(options)),
+		  n_shards_(options_.shards ? options_.shards : 1),
+		  shards_(new shard[n_shards_]) {}
+
+	// Returns the cached result, or stats the path and caches that.
+	error_or<filestat> stat(fd dir, string_view path, bool follow_symlinks = true) {
+		std::uint64_t h = hash(dir, path, follow_symlinks);
+		shard &s = shard_for(h);
+		timestamp now = options_.ttl ? current_time() : 0;
+		std::uint64_t generation;
+		{
+			std::lock_guard<std::mutex> lock(s.mutex);
+			generation = s.generation;
+			size_t i = s.find(h, dir, path, follow_symlinks);
+			if (i != npos) {
+				slot const &e = s.slots[i];
+				if (e.expires == 0 || now < e.expires) {
+					hits_.fetch_add(1, std::memory_order_relaxed);
+					if (e.err != error(0)) return e.err;
+					return e.stat;
+				}
+				s.erase(i);
+				expired_.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		misses_.fetch_add(1, std::memory_order_relaxed);
+		auto stat = dir.file_stat_get(path, follow_symlinks);
+		if (stat) {
+			store(h, generation, dir, path, follow_symlinks, error(0), *stat, now);
+		} else if (options_.cache_noent && stat.error() == error::noent) {
+			store(h, generation, dir, path, follow_symlinks, error::noent, filestat(), now);
+		}
+		return stat;
+	}
+
+	// Stats all entries of the directory at path, relative to dir, and caches
+	// them as paths relative to dir. An empty path lists dir itself. Entries
+	// that aren't symbolic links are cached for lookups both with and
+	// without following symbolic links. Returns the number of entries.
+	error_or<size_t> prefetch(fd dir, string_view path = {}) {
+		unique_fd opened;
+		fd list_fd = dir;
+		if (path.size() > 0) {
+			auto d = dir.file_open(path, rights::file_readdir | rights::file_stat_get, oflags::directory);
+			if (!d) return d.error();
+			opened = std::move(*d);
+			list_fd = opened.get();
+		}
+		timestamp now = options_.ttl ? current_time() : 0;
+		std::string full(path.data(), path.size());
+		if (!full.empty() && full.back() != '/') full += '/';
+		size_t prefix = full.size();
+		size_t n = 0;
+		dir_reader reader(list_fd);
+		for (auto const &e : reader) {
+			if (e.name == "." || e.name == "..") continue;
+			full.resize(prefix);
+			full.append(e.name.data(), e.name.size());
+			string_view key(full.data(), full.size());
+			std::uint64_t h_nofollow = hash(dir, key, false);
+			std::uint64_t h_follow = hash(dir, key, true);
+			std::uint64_t g_nofollow = generation(h_nofollow);
+			std::uint64_t g_follow = generation(h_follow);
+			auto stat = list_fd.file_stat_get(e.name, false);
+			if (!stat) continue;
+			store(h_nofollow, g_nofollow, dir, key, false, error(0), *stat, now);
+			if (stat->st_filetype != filetype::symbolic_link) {
+				store(h_follow, g_follow, dir, key, true, error(0), *stat, now);
+			}
+			++n;
+		}
+		if (!reader.status()) return reader.status().error();
+		prefetched_.fetch_add(n, std::memory_order_relaxed);
+		return n;
+	}
+
+	// Drops the entries for a path, both with and without following symbolic
+	// links.
+	void invalidate(fd dir, string_view path) {
+		for (bool follow : {false, true}) {
+			std::uint64_t h = hash(dir, path, follow);
+			shard &s = shard_for(h);
+			std::lock_guard<std::mutex> lock(s.mutex);
+			++s.generation;
+			size_t i = s.find(h, dir, path, follow);
+			if (i != npos) {
+				s.erase(i);
+				invalidated_.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Drops all entries relative to dir.
+	void invalidate(fd dir) {
+		for (size_t j = 0; j < n_shards_; ++j) {
+			shard &s = shards_[j];
+			std::lock_guard<std::mutex> lock(s.mutex);
+			++s.generation;
+			for (size_t i = 0; i < s.slots.size(); ++i) {
+				if (s.slots[i].state == slot::full && s.slots[i].dir == dir.number()) {
+					s.erase(i);
+					invalidated_.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+		}
+	}
+
+	void clear() {
+		for (size_t j = 0; j < n_shards_; ++j) {
+			shard &s = shards_[j];
+			std::lock_guard<std::mutex> lock(s.mutex);
+			++s.generation;
+			s.slots.clear();
+			s.size = s.used = 0;
+		}
+	}
+
+	size_t size() const {
+		size_t n = 0;
+		for (size_t j = 0; j < n_shards_; ++j) {
+			std::lock_guard<std::mutex> lock(shards_[j].mutex);
+			n += shards_[j].size;
+		}
+		return n;
+	}
+
+	stat_cache_stats stats() const {
+		return {
+			hits_.load(std::memory_order_relaxed),
+			misses_.load(std::memory_order_relaxed),
+			expired_.load(std::memory_order_relaxed),
+			invalidated_.load(std::memory_order_relaxed),
+			prefetched_.load(std::memory_order_relaxed),
+		};
+	}
+
+private:
+	static constexpr size_t npos = size_t(-1);
+
+	struct slot {
+		enum : unsigned char { empty, full, deleted } state = empty;
+		bool follow_symlinks = false;
+		cloudabi_fd_t dir = 0;
+		std::uint64_t hash = 0;
+		std::string path;
+		// Either error(0) and the result, or the error.
+		error err = error(0);
+		filestat stat;
+		// Zero if the entry doesn't expire.
+		timestamp expires = 0;
+	};
+
+	struct shard {
+		mutable std::mutex mutex;
+		// The size is zero or a power of two.
+		std::vector<slot> slots;
+		// Full slots, and full or deleted slots.
+		size_t size = 0;
+		size_t used = 0;
+		// Bumped by every invalidation, so that results of stats that
+		// started before it aren't stored after it.
+		std::uint64_t generation = 0;
+
+		size_t find(std::uint64_t h, fd dir, string_view path, bool follow) const {
+			if (slots.empty()) return npos;
+			size_t mask = slots.size() - 1;
+			for (size_t i = size_t(h) & mask;; i = (i + 1) & mask) {
+				slot const &s = slots[i];
+				if (s.state == slot::empty) return npos;
+				if (s.state == slot::full && s.hash == h && s.dir == dir.number() &&
+				    s.follow_symlinks == follow && s.path.size() == path.size() &&
+				    s.path.compare(0, s.path.size(), path.data(), path.size()) == 0) {
+					return i;
+				}
+			}
+		}
+
+		void erase(size_t i) {
+			slots[i].state = slot::deleted;
+			slots[i].path.clear();
+			--size;
+		}
+
+		// Returns a slot for a key that isn't in the table.
+		slot &insert(std::uint64_t h) {
+			if ((used + 1) * 4 > slots.size() * 3) {
+				rehash(size * 2 + 2 > slots.size() ? slots.size() * 2 : slots.size());
+			}
+			size_t mask = slots.size() - 1;
+			size_t i = size_t(h) & mask;
+			while (slots[i].state == slot::full) i = (i + 1) & mask;
+			if (slots[i].state == slot::empty) ++used;
+			++size;
+			slots[i].state = slot::full;
+			slots[i].hash = h;
+			return slots[i];
+		}
+
+		void rehash(size_t capacity) {
+			if (capacity < 16) capacity = 16;
+			std::vector<slot> old(capacity);
+			old.swap(slots);
+			size = used = 0;
+			for (slot &s : old) {
+				if (s.state != slot::full) continue;
+				slot &n = insert(s.hash);
+				n = std::move(s);
+			}
+		}
+	};
+
+	stat_cache_options options_;
+	size_t n_shards_;
+	std::unique_ptr<shard[]> shards_;
+
+	std::atomic<std::uint64_t> hits_{0};
+	std::atomic<std::uint64_t> misses_{0};
+	std::atomic<std::uint64_t> expired_{0};
+	std::atomic<std::uint64_t> invalidated_{0};
+	std::atomic<std::uint64_t> prefetched_{0};
+
+	static std::uint64_t hash(fd dir, string_view path, bool follow) {
+		// FNV-1a.
+		std::uint64_t h = 14695981039346656037u;
+		for (char c : path) h = (h ^ (unsigned char)c) * 1099511628211u;
+		h = (h ^ std::uint64_t(dir.number())) * 1099511628211u;
+		h = (h ^ (follow ? 1 : 0)) * 1099511628211u;
+		return h;
+	}
+
+	shard &shard_for(std::uint64_t h) { return shards_[(h >> 32) % n_shards_]; }
+
+	timestamp current_time() {
+		auto t = clock_time_get(clockid::monotonic);
+		return t ? *t : 0;
+	}
+
+	std::uint64_t generation(std::uint64_t h) {
+		shard &s = shard_for(h);
+		std::lock_guard<std::mutex> lock(s.mutex);
+		return s.generation;
+	}
+
+	// Stores the result of a stat that started when the shard was at the
+	// given generation, unless it has been invalidated since.
+	void store(
+		std::uint64_t h, std::uint64_t generation, fd dir, string_view path, bool follow,
+		error err, filestat const &stat, timestamp now
+	) {
+		shard &s = shard_for(h);
+		std::lock_guard<std::mutex> lock(s.mutex);
+		if (s.generation != generation) return;
+		size_t i = s.find(h, dir, path, follow);
+		slot &e = i != npos ? s.slots[i] : s.insert(h);
+		e.follow_symlinks = follow;
+		e.dir = dir.number();
+		e.path.assign(path.data(), path.size());
+		e.err = err;
+		e.stat = stat;
+		e.expires = options_.ttl ? now + options_.ttl : 0;
+	}
+
+};
+
+}
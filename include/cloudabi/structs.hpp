@@ -42,6 +42,19 @@
 
 namespace cloudabi {
 
+struct dirent {
+  dircookie d_next;
+  inode d_ino;
+  std::uint32_t d_namlen;
+  filetype d_type;
+};
+static_assert(sizeof(dirent) == sizeof(cloudabi_dirent_t), "");
+static_assert(alignof(dirent) == alignof(cloudabi_dirent_t), "");
+static_assert(offsetof(dirent, d_next) == offsetof(cloudabi_dirent_t, d_next), "");
+static_assert(offsetof(dirent, d_ino) == offsetof(cloudabi_dirent_t, d_ino), "");
+static_assert(offsetof(dirent, d_namlen) == offsetof(cloudabi_dirent_t, d_namlen), "");
+static_assert(offsetof(dirent, d_type) == offsetof(cloudabi_dirent_t, d_type), "");
+
 struct event {
   userdata userdata;
   error error;
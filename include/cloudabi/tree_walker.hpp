@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <mstd/string_view.hpp>
+
+#include "dir_reader.hpp"
+#include "error_or.hpp"
+#include "fd.hpp"
+#include "fd_impl.hpp"
+#include "structs.hpp"
+#include "types.hpp"
+
+namespace cloudabi {
+
+using mstd::string_view;
+
+struct walk_entry {
+	// Relative to the root of the walk.
+	string_view path;
+	string_view name;
+	filestat stat;
+	// One for the entries of the root directory.
+	size_t depth;
+};
+
+struct walk_options {
+	// Zero uses one thread per core.
+	size_t threads = 0;
+	// The number of directories that may be open at the same time.
+	size_t max_open_dirs = 64;
+	// Directories at this depth are reported, but not entered.
+	size_t max_depth = SIZE_MAX;
+	// Whether to stat and enter the targets of symbolic links. Directories
+	// that are reached more than once are only entered once.
+	bool follow_symlinks = false;
+	// Report the entries in sorted pre-order, from the calling thread, after
+	// the walk. Otherwise, they are reported by the worker threads as they
+	// are found, in no particular order.
+	bool ordered = false;
+	// Called for every directory that couldn't be listed and every entry that
+	// couldn't be stat'ed, one at a time.
+	std::function<void(string_view path, error)> on_error;
+};
+
+// Walks a directory tree from a pool of threads.
+//
+// Every thread has a queue of directories to scan, and steals from the
+// other queues when its own is empty. Directories are opened relative to the
+// root, listed with dir_reader and every entry is stat'ed relative to its
+// directory, so the walk only needs the rights of the root directory.
+//
+// Without walk_options::ordered, the callback is called concurrently from all
+// threads. With it, all entries are kept in memory until the walk is done.
+class tree_walker {
+
+public:
+	using callback = std::function<void(walk_entry const &)>;
+
+	explicit tree_walker(fd root, walk_options options = {})
+		: root_(root), options_(std::move(options)) {}
+
+	// Blocks until the whole tree has been walked. Only fails if the root
+	// itself can't be stat'ed.
+	error_or<void> walk(callback f);
+
+private:
+	struct dir_node;
+
+	struct result {
+		std::string name;
+		filestat stat;
+		std::unique_ptr<dir_node> child;
+	};
+
+	struct dir_node {
+		std::string path;
+		size_t depth;
+		// Only used with walk_options::ordered.
+		std::vector<result> entries;
+	};
+
+	struct worker_queue {
+		std::mutex mutex;
+		std::deque<dir_node *> queue;
+	};
+
+	fd root_;
+	walk_options options_;
+	callback callback_;
+
+	std::unique_ptr<worker_queue[]> queues_;
+	size_t n_queues_ = 0;
+
+	// Directories that have been queued but not scanned yet.
+	std::atomic<size_t> pending_{0};
+	std::mutex idle_mutex_;
+	std::condition_variable idle_cv_;
+
+	std::mutex open_mutex_;
+	std::condition_variable open_cv_;
+	size_t open_dirs_ = 0;
+
+	std::mutex visited_mutex_;
+	std::set<std::pair<cloudabi_device_t, cloudabi_inode_t>> visited_;
+
+	std::mutex error_mutex_;
+
+	void push(size_t worker, dir_node *d) {
+		pending_.fetch_add(1);
+		{
+			std::lock_guard<std::mutex> lock(queues_[worker].mutex);
+			queues_[worker].queue.push_back(d);
+		}
+		std::lock_guard<std::mutex> lock(idle_mutex_);
+		idle_cv_.notify_one();
+	}
+
+	// Takes the newest directory from the own queue, or the oldest one from
+	// another queue, as those tend to have the largest subtrees.
+	dir_node *pop(size_t worker) {
+		{
+			worker_queue &q = queues_[worker];
+			std::lock_guard<std::mutex> lock(q.mutex);
+			if (!q.queue.empty()) {
+				dir_node *d = q.queue.back();
+				q.queue.pop_back();
+				return d;
+			}
+		}
+		for (size_t i = 1; i < n_queues_; ++i) {
+			worker_queue &q = queues_[(worker + i) % n_queues_];
+			std::lock_guard<std::mutex> lock(q.mutex);
+			if (!q.queue.empty()) {
+				dir_node *d = q.queue.front();
+				q.queue.pop_front();
+				return d;
+			}
+		}
+		return nullptr;
+	}
+
+	void run(size_t worker) {
+		std::string path;
+		for (;;) {
+			if (dir_node *d = pop(worker)) {
+				scan(worker, *d, path);
+				// Without a tree to keep, queued directories are owned by the
+				// queue.
+				if (!options_.ordered) delete d;
+				if (pending_.fetch_sub(1) == 1) {
+					std::lock_guard<std::mutex> lock(idle_mutex_);
+					idle_cv_.notify_all();
+				}
+				continue;
+			}
+			// push() notifies with idle_mutex_ held after queueing, so
+			// checking the queues with it held can't miss new work.
+			std::unique_lock<std::mutex> lock(idle_mutex_);
+			idle_cv_.wait(lock, [this] { return pending_.load() == 0 || has_work(); });
+			if (pending_.load() == 0) return;
+		}
+	}
+
+	bool has_work() {
+		for (size_t i = 0; i < n_queues_; ++i) {
+			std::lock_guard<std::mutex> lock(queues_[i].mutex);
+			if (!queues_[i].queue.empty()) return true;
+		}
+		return false;
+	}
+
+	void acquire_dir() {
+		std::unique_lock<std::mutex> lock(open_mutex_);
+		open_cv_.wait(lock, [this] { return open_dirs_ < options_.max_open_dirs; });
+		++open_dirs_;
+	}
+
+	void release_dir() {
+		std::lock_guard<std::mutex> lock(open_mutex_);
+		--open_dirs_;
+		open_cv_.notify_one();
+	}
+
+	void report_error(string_view path, error e) {
+		if (!options_.on_error) return;
+		std::lock_guard<std::mutex> lock(error_mutex_);
+		options_.on_error(path, e);
+	}
+
+	// Returns false if the directory has been entered before.
+	bool visit(filestat const &stat) {
+		if (!options_.follow_symlinks) return true;
+		std::lock_guard<std::mutex> lock(visited_mutex_);
+		return visited_.emplace(cloudabi_device_t(stat.st_dev), cloudabi_inode_t(stat.st_ino)).second;
+	}
+
+	void scan(size_t worker, dir_node &d, std::string &path) {
+		string_view dir_path(d.path.data(), d.path.size());
+		acquire_dir();
+		auto dir = d.path.empty()
+			? root_.dup()
+			: root_.file_open(dir_path, rights::file_readdir | rights::file_stat_get,
+				oflags::directory, fdflags::none, rights::none, options_.follow_symlinks);
+		if (!dir) {
+			release_dir();
+			report_error(dir_path, dir.error());
+			return;
+		}
+		fd dir_fd = dir->get();
+		dir_reader reader(dir_fd);
+		for (auto const &e : reader) {
+			if (e.name == "." || e.name == "..") continue;
+			path.assign(d.path);
+			if (!path.empty()) path += '/';
+			path.append(e.name.data(), e.name.size());
+			auto stat = dir_fd.file_stat_get(e.name, options_.follow_symlinks);
+			if (!stat) {
+				report_error(string_view(path.data(), path.size()), stat.error());
+				continue;
+			}
+			std::unique_ptr<dir_node> child;
+			if (stat->st_filetype == filetype::directory && d.depth + 1 < options_.max_depth && visit(*stat)) {
+				child.reset(new dir_node{path, d.depth + 1, {}});
+			}
+			if (options_.ordered) {
+				d.entries.push_back(result{std::string(e.name.data(), e.name.size()), *stat, nullptr});
+				if (child) push(worker, child.get());
+				d.entries.back().child = std::move(child);
+			} else {
+				callback_(make_entry(path, e.name.size(), *stat, d.depth + 1));
+				if (child) push(worker, child.release());
+			}
+		}
+		if (!reader.status()) report_error(dir_path, reader.status().error());
+		release_dir();
+		if (options_.ordered) {
+			std::sort(d.entries.begin(), d.entries.end(),
+				[](result const &a, result const &b) { return a.name < b.name; });
+		}
+	}
+
+	static walk_entry make_entry(std::string const &path, size_t name_size, filestat const &stat, size_t depth) {
+		return walk_entry{
+			string_view(path.data(), path.size()),
+			string_view(path.data() + path.size() - name_size, name_size),
+			stat, depth
+		};
+	}
+
+	void report(dir_node const &d, std::string &path) {
+		for (result const &r : d.entries) {
+			path.assign(d.path);
+			if (!path.empty()) path += '/';
+			path += r.name;
+			callback_(make_entry(path, r.name.size(), r.stat, d.depth + 1));
+			if (r.child) report(*r.child, path);
+		}
+	}
+
+};
+
+inline error_or<void> tree_walker::walk(callback f) {
+	auto root_stat = root_.file_stat_fget();
+	if (!root_stat) return root_stat.error();
+	callback_ = std::move(f);
+	visited_.clear();
+	visit(*root_stat);
+	if (options_.max_depth == 0) return {};
+	std::unique_ptr<dir_node> root(new dir_node{std::string(), 0, {}});
+
+	n_queues_ = options_.threads ? options_.threads : std::max(1u, std::thread::hardware_concurrency());
+	queues_.reset(new worker_queue[n_queues_]);
+	push(0, options_.ordered ? root.get() : root.release());
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < n_queues_; ++i) threads.emplace_back([this, i] { run(i); });
+	run(0);
+	for (std::thread &t : threads) t.join();
+
+	if (options_.ordered) {
+		std::string path;
+		report(*root, path);
+	}
+	return {};
+}
+
+}
@@ -56,6 +56,10 @@ enum class condvar : cloudabi_condvar_t {
 
 enum class device : cloudabi_device_t {};
 
+enum class dircookie : cloudabi_dircookie_t {
+  start = CLOUDABI_DIRCOOKIE_START,
+};
+
 enum class error : cloudabi_errno_t {
   _2big          = CLOUDABI_E2BIG,
   acces          = CLOUDABI_EACCES,
@@ -608,6 +612,8 @@ enum class whence : cloudabi_whence_t {
   set = CLOUDABI_WHENCE_SET,
 };
 
+struct dirent;
+
 struct event;
 
 struct fdstat;
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <mstd/range.hpp>
+
+#include "error_or.hpp"
+#include "fd.hpp"
+#include "fd_impl.hpp"
+#include "iovec.hpp"
+#include "types.hpp"
+
+namespace cloudabi {
+
+using mstd::range;
+
+// A queue of data waiting to be written to a file descriptor, such as the
+// output of a connection.
+//
+// Segments are either owned by the queue, or borrowed, in which case an
+// optional release function is called once the segment has been written or
+// the queue is destroyed. Small copied segments are coalesced into shared
+// chunks.
+//
+// The ciovecs of all queued segments are kept in a single array, which is
+// passed to fd::write() directly, up to max_iovecs at a time. After a partial
+// write, only the written ciovecs are skipped and the first remaining one is
+// shortened, so the cost is proportional to the number of segments written.
+// Does not own the file descriptor.
+class write_queue {
+
+private:
+	struct segment {
+		std::vector<unsigned char> owned;
+		std::function<void()> release;
+	};
+
+	fd fd_;
+	size_t max_iovecs_;
+	size_t chunk_size_;
+
+	// Both arrays have an element per segment. Segments before head_ are
+	// done, and are dropped once they make up half of the arrays.
+	std::vector<ciovec> iovecs_;
+	std::vector<segment> segments_;
+	size_t head_ = 0;
+	size_t bytes_ = 0;
+
+	// Whether the last segment is a chunk that push_copy() may append to.
+	// Its capacity is reserved up front, so the data never moves.
+	bool tail_is_chunk_ = false;
+
+	void add(ciovec data, segment s) {
+		iovecs_.push_back(data);
+		segments_.push_back(std::move(s));
+		bytes_ += data.size();
+		tail_is_chunk_ = false;
+	}
+
+	void drop_done() {
+		if (head_ == segments_.size()) {
+			iovecs_.clear();
+			segments_.clear();
+			head_ = 0;
+			tail_is_chunk_ = false;
+		} else if (head_ > 0 && head_ >= segments_.size() / 2) {
+			iovecs_.erase(iovecs_.begin(), iovecs_.begin() + head_);
+			segments_.erase(segments_.begin(), segments_.begin() + head_);
+			head_ = 0;
+		}
+	}
+
+	// Marks n bytes as written.
+	void advance(size_t n) {
+		bytes_ -= n;
+		while (n > 0) {
+			ciovec &iov = iovecs_[head_];
+			if (n < iov.size()) {
+				iov = ciovec(iov.data() + n, iov.size() - n);
+				return;
+			}
+			n -= iov.size();
+			segment &s = segments_[head_];
+			if (s.release) s.release();
+			s = segment();
+			++head_;
+		}
+		// Skip empty segments, so they are released too.
+		while (head_ < segments_.size() && iovecs_[head_].size() == 0) {
+			segment &s = segments_[head_];
+			if (s.release) s.release();
+			s = segment();
+			++head_;
+		}
+		drop_done();
+	}
+
+public:
+	explicit write_queue(fd f, size_t max_iovecs = 1024, size_t chunk_size = 4096)
+		: fd_(f), max_iovecs_(max_iovecs), chunk_size_(chunk_size) {}
+
+	write_queue(write_queue const &) = delete;
+	write_queue &operator=(write_queue const &) = delete;
+
+	~write_queue() { clear(); }
+
+	fd get_fd() const { return fd_; }
+
+	bool empty() const { return bytes_ == 0; }
+
+	// The number of bytes waiting to be written.
+	size_t size() const { return bytes_; }
+
+	// The number of segments waiting to be written.
+	size_t segments() const { return segments_.size() - head_; }
+
+	// Queues data that is owned by the queue from now on.
+	void push(std::vector<unsigned char> data) {
+		ciovec iov(data.data(), data.size());
+		add(iov, segment{std::move(data), {}});
+	}
+
+	// Queues a copy of data. Data smaller than the chunk size is appended to
+	// the last chunk if it fits.
+	void push_copy(ciovec data) {
+		if (data.size() >= chunk_size_) {
+			push(std::vector<unsigned char>(data.begin(), data.end()));
+			return;
+		}
+		if (tail_is_chunk_) {
+			std::vector<unsigned char> &chunk = segments_.back().owned;
+			if (chunk.capacity() - chunk.size() >= data.size()) {
+				chunk.insert(chunk.end(), data.begin(), data.end());
+				ciovec &iov = iovecs_.back();
+				iov = ciovec(iov.data(), iov.size() + data.size());
+				bytes_ += data.size();
+				return;
+			}
+		}
+		std::vector<unsigned char> chunk;
+		chunk.reserve(chunk_size_);
+		chunk.insert(chunk.end(), data.begin(), data.end());
+		push(std::move(chunk));
+		tail_is_chunk_ = true;
+	}
+
+	// Queues data without copying it. The data must stay valid until release
+	// is called.
+	void push_borrowed(ciovec data, std::function<void()> release = {}) {
+		add(data, segment{{}, std::move(release)});
+	}
+
+	// Writes as much as a single vectored write allows. Returns the number of
+	// bytes written. A write that makes no progress fails with error::io, so
+	// that flush() can't loop forever.
+	error_or<size_t> flush_once() {
+		if (empty()) return size_t(0);
+		// Release empty segments first, so that the first ciovec isn't empty.
+		advance(0);
+		size_t n_iovecs = std::min(segments(), max_iovecs_);
+		auto n = fd_.write(range<ciovec const>(iovecs_.data() + head_, n_iovecs));
+		if (!n) return n.error();
+		if (*n == 0) return error::io;
+		advance(*n);
+		return *n;
+	}
+
+	// Writes until the queue is empty, or until the file descriptor returns
+	// an error, such as error::again for non-blocking file descriptors.
+	error_or<void> flush() {
+		while (!empty()) {
+			auto n = flush_once();
+			if (!n) return n.error();
+		}
+		// Release any empty segments that are left.
+		advance(0);
+		return {};
+	}
+
+	// Drops everything that hasn't been written, releasing borrowed
+	// segments.
+	void clear() {
+		for (size_t i = head_; i < segments_.size(); ++i) {
+			if (segments_[i].release) segments_[i].release();
+		}
+		iovecs_.clear();
+		segments_.clear();
+		head_ = 0;
+		bytes_ = 0;
+		tail_is_chunk_ = false;
+	}
+
+};
+
+}